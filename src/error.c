@@ -1,133 +1,839 @@
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+// The SSSE3 and SSE4.2 kernels are compiled with a function target attribute
+// and picked at run time, so the default build uses them on any CPU that has
+// them without -m flags
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ECC_X86_DISPATCH
+#include <tmmintrin.h>
+#include <nmmintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
 
 #include "error.h"
 
-#define HAMMING_N 7
-#define HAMMING_K 4
+// Tables worked out from the systematic generator and parity check matrices
+//
+//     G = | 1 0 0 0 1 1 0 |      H = | 1 1 0 1 1 0 0 |
+//         | 0 1 0 0 1 0 1 |          | 1 0 1 1 0 1 0 |
+//         | 0 0 1 0 0 1 1 |          | 0 1 1 1 0 0 1 |
+//         | 0 0 0 1 1 1 1 |
+//
+// A codeword x0..x6 is stored in bits 7..1 of a byte (bit 0 is unused), so the
+// data nibble is the high nibble of the byte.
 
-const unsigned char H[HAMMING_N - HAMMING_K][HAMMING_N] = {
-    { 1, 1, 0, 1, 1, 0, 0 },
-    { 1, 0, 1, 1, 0, 1, 0 },
-    { 0, 1, 1, 1, 0, 0, 1 }
+// Codeword byte of each nibble
+static const unsigned char HAMMING_ENCODE[16] = {
+    0x00, 0x1e, 0x26, 0x38, 0x4a, 0x54, 0x6c, 0x72,
+    0x8c, 0x92, 0xaa, 0xb4, 0xc6, 0xd8, 0xe0, 0xfe,
 };
 
-const unsigned char G[HAMMING_K][HAMMING_N] = {
-    { 1, 0, 0, 0, 1, 1, 0 },
-    { 0, 1, 0, 0, 1, 0, 1 },
-    { 0, 0, 1, 0, 0, 1, 1 },
-    { 0, 0, 0, 1, 1, 1, 1 },
+// Corrected nibble of every received byte (single bit errors)
+static const unsigned char HAMMING_DECODE[256] = {
+    0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x2, 0x2, 0x0, 0x0, 0x4, 0x4, 0x8, 0x8, 0x1, 0x1,
+    0x0, 0x0, 0x9, 0x9, 0x5, 0x5, 0x1, 0x1, 0x3, 0x3, 0x1, 0x1, 0x1, 0x1, 0x1, 0x1,
+    0x0, 0x0, 0x2, 0x2, 0x2, 0x2, 0x2, 0x2, 0x3, 0x3, 0xa, 0xa, 0x6, 0x6, 0x2, 0x2,
+    0x3, 0x3, 0x7, 0x7, 0xb, 0xb, 0x2, 0x2, 0x3, 0x3, 0x3, 0x3, 0x3, 0x3, 0x1, 0x1,
+    0x0, 0x0, 0x4, 0x4, 0x5, 0x5, 0xc, 0xc, 0x4, 0x4, 0x4, 0x4, 0x6, 0x6, 0x4, 0x4,
+    0x5, 0x5, 0x7, 0x7, 0x5, 0x5, 0x5, 0x5, 0xd, 0xd, 0x4, 0x4, 0x5, 0x5, 0x1, 0x1,
+    0xe, 0xe, 0x7, 0x7, 0x6, 0x6, 0x2, 0x2, 0x6, 0x6, 0x4, 0x4, 0x6, 0x6, 0x6, 0x6,
+    0x7, 0x7, 0x7, 0x7, 0x5, 0x5, 0x7, 0x7, 0x3, 0x3, 0x7, 0x7, 0x6, 0x6, 0xf, 0xf,
+    0x0, 0x0, 0x9, 0x9, 0x8, 0x8, 0xc, 0xc, 0x8, 0x8, 0xa, 0xa, 0x8, 0x8, 0x8, 0x8,
+    0x9, 0x9, 0x9, 0x9, 0xb, 0xb, 0x9, 0x9, 0xd, 0xd, 0x9, 0x9, 0x8, 0x8, 0x1, 0x1,
+    0xe, 0xe, 0xa, 0xa, 0xb, 0xb, 0x2, 0x2, 0xa, 0xa, 0xa, 0xa, 0x8, 0x8, 0xa, 0xa,
+    0xb, 0xb, 0x9, 0x9, 0xb, 0xb, 0xb, 0xb, 0x3, 0x3, 0xa, 0xa, 0xb, 0xb, 0xf, 0xf,
+    0xe, 0xe, 0xc, 0xc, 0xc, 0xc, 0xc, 0xc, 0xd, 0xd, 0x4, 0x4, 0x8, 0x8, 0xc, 0xc,
+    0xd, 0xd, 0x9, 0x9, 0x5, 0x5, 0xc, 0xc, 0xd, 0xd, 0xd, 0xd, 0xd, 0xd, 0xf, 0xf,
+    0xe, 0xe, 0xe, 0xe, 0xe, 0xe, 0xc, 0xc, 0xe, 0xe, 0xa, 0xa, 0x6, 0x6, 0xf, 0xf,
+    0xe, 0xe, 0x7, 0x7, 0xb, 0xb, 0xf, 0xf, 0xd, 0xd, 0xf, 0xf, 0xf, 0xf, 0xf, 0xf,
 };
 
-static void hamming__helper_encode(unsigned char nibble, unsigned char *byte) {
-    unsigned char a[HAMMING_K] = {
-        (nibble >> 3) & 1,
-        (nibble >> 2) & 1,
-        (nibble >> 1) & 1,
-        (nibble >> 0) & 1
-    };
-    unsigned char x[HAMMING_N] = {0};
+#if defined(ECC_X86_DISPATCH)
+// H is linear, so the syndrome of a byte is the xor of the syndromes of its
+// two nibbles; the correction then only has to flip a data bit when the
+// syndrome points at x0..x3.
+static const unsigned char HAMMING_SYNDROME_HIGH[16] = {
+    0, 7, 3, 4, 5, 2, 6, 1, 6, 1, 5, 2, 3, 4, 0, 7,
+};
 
-    for (size_t i = 0; i < HAMMING_N; i++) {
-        unsigned char sum = 0;
-        for (size_t j = 0; j < HAMMING_K; j++) {
-            sum += a[j] * G[j][i];
-        }
-        x[i] = (sum % 2) & 1;
+static const unsigned char HAMMING_SYNDROME_LOW[16] = {
+    0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7,
+};
+
+static const unsigned char HAMMING_CORRECTION[16] = {
+    0, 0, 0, 2, 0, 4, 8, 1, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+#endif
+
+// Packed layout: the 7 bits of each codeword are written back to back, most
+// significant bit first, so 8 codewords (4 payload bytes) take 7 bytes. The
+// kernels below squeeze the unused bit 0 out of 8 codeword bytes (and put it
+// back) with three shift-and-mask steps on a 64-bit word.
+#define HAMMING_GROUP_BYTES 4
+#define HAMMING_GROUP_PACKED 7
+
+static uint64_t hamming__pack(const unsigned char codewords[8]) {
+    uint64_t y = 0;
+    for (size_t k = 0; k < 8; k++) {
+        y = (y << 8) | codewords[k];
     }
 
-    *byte = 0;
-    for (size_t i = 0; i < HAMMING_N; i++) {
-        *byte = *byte | (x[i] << (HAMMING_N - i));
+    y = (y & 0xfe00fe00fe00fe00ull) | ((y & 0x00fe00fe00fe00feull) << 1);
+    y = (y & 0xfffc0000fffc0000ull) | ((y & 0x0000fffc0000fffcull) << 2);
+    y = (y & 0xfffffff000000000ull) | ((y & 0x00000000fffffff0ull) << 4);
+    return y;
+}
+
+static void hamming__unpack(uint64_t y, unsigned char codewords[8]) {
+    y = (y & 0xfffffff000000000ull) | ((y >> 4) & 0x00000000fffffff0ull);
+    y = (y & 0xfffc0000fffc0000ull) | ((y >> 2) & 0x0000fffc0000fffcull);
+    y = (y & 0xfe00fe00fe00fe00ull) | ((y >> 1) & 0x00fe00fe00fe00feull);
+
+    for (size_t k = 0; k < 8; k++) {
+        codewords[k] = (y >> (56 - 8 * k)) & 0xff;
     }
 }
 
-static void hamming__helper_decode(unsigned char byte, unsigned char *nibble) {
-    unsigned char r[HAMMING_N] = {0};
-    for (size_t i = 0; i < HAMMING_N; i++) {
-        r[i] = (byte >> (HAMMING_N - i)) & 1;
+static void hamming__encode_group(const unsigned char a[HAMMING_GROUP_BYTES], unsigned char x[HAMMING_GROUP_PACKED]) {
+    unsigned char codewords[8];
+    for (size_t k = 0; k < HAMMING_GROUP_BYTES; k++) {
+        codewords[k * 2] = HAMMING_ENCODE[(a[k] >> 4) & 0b00001111];
+        codewords[k * 2 + 1] = HAMMING_ENCODE[a[k] & 0b00001111];
     }
 
-    unsigned char s[HAMMING_N - HAMMING_K] = {0};
-    for (size_t i = 0; i < HAMMING_N - HAMMING_K; i++) {
-        unsigned char sum = 0;
-        for (size_t j = 0; j < HAMMING_N; j++) {
-            sum += H[i][j] * r[j];
-        }
-        s[i] = (sum % 2) & 1;
+    uint64_t y = hamming__pack(codewords);
+    for (size_t k = 0; k < HAMMING_GROUP_PACKED; k++) {
+        x[k] = (y >> (56 - 8 * k)) & 0xff;
+    }
+}
+
+static void hamming__decode_group(const unsigned char x[HAMMING_GROUP_PACKED], unsigned char a[HAMMING_GROUP_BYTES]) {
+    uint64_t y = 0;
+    for (size_t k = 0; k < HAMMING_GROUP_PACKED; k++) {
+        y |= (uint64_t)x[k] << (56 - 8 * k);
     }
 
-    size_t syndrome = 0;
-    for (size_t i = 0; i < HAMMING_N - HAMMING_K; i++) {
-        syndrome = syndrome | (s[i] << (HAMMING_N - HAMMING_K - i - 1));
+    unsigned char codewords[8];
+    hamming__unpack(y, codewords);
+    for (size_t k = 0; k < HAMMING_GROUP_BYTES; k++) {
+        a[k] = (HAMMING_DECODE[codewords[k * 2]] << 4) | HAMMING_DECODE[codewords[k * 2 + 1]];
     }
+}
 
-    if (syndrome == 0) {
-        *nibble = (byte >> 4) & 0b00001111;
-        return;
+#if defined(ECC_X86_DISPATCH)
+// 16 bytes are 32 nibbles, looked up with one pshufb per half and interleaved
+// so the high nibble's codeword comes first. Each 64-bit lane of the results
+// holds the 8 codewords of one group.
+__attribute__((target("ssse3")))
+static inline void hamming__encode_bytes_ssse3(__m128i v, __m128i codewords[2]) {
+    const __m128i table = _mm_loadu_si128((const __m128i *)HAMMING_ENCODE);
+    const __m128i low_mask = _mm_set1_epi8(0x0f);
+    __m128i high = _mm_shuffle_epi8(table, _mm_and_si128(_mm_srli_epi16(v, 4), low_mask));
+    __m128i lower = _mm_shuffle_epi8(table, _mm_and_si128(v, low_mask));
+    codewords[0] = _mm_unpacklo_epi8(high, lower);
+    codewords[1] = _mm_unpackhi_epi8(high, lower);
+}
+
+// 32 codewords: syndrome and correction with three pshufb, then pmaddubsw
+// folds each (high, lower) pair into high * 16 + lower
+__attribute__((target("ssse3")))
+static inline __m128i hamming__decode_bytes_ssse3(const __m128i codewords[2]) {
+    const __m128i syndrome_high = _mm_loadu_si128((const __m128i *)HAMMING_SYNDROME_HIGH);
+    const __m128i syndrome_low = _mm_loadu_si128((const __m128i *)HAMMING_SYNDROME_LOW);
+    const __m128i correction = _mm_loadu_si128((const __m128i *)HAMMING_CORRECTION);
+    const __m128i low_mask = _mm_set1_epi8(0x0f);
+    const __m128i weights = _mm_set1_epi16(0x0110);
+    __m128i nibbles[2];
+    for (size_t k = 0; k < 2; k++) {
+        __m128i data = _mm_and_si128(_mm_srli_epi16(codewords[k], 4), low_mask);
+        __m128i s = _mm_xor_si128(_mm_shuffle_epi8(syndrome_high, data),
+                                  _mm_shuffle_epi8(syndrome_low, _mm_and_si128(codewords[k], low_mask)));
+        data = _mm_xor_si128(data, _mm_shuffle_epi8(correction, s));
+        nibbles[k] = _mm_maddubs_epi16(data, weights);
     }
+    return _mm_packus_epi16(nibbles[0], nibbles[1]);
+}
 
-    size_t index = 0;
-    for (size_t i = 0; i < HAMMING_N; i++) {
-        int matching = 1;
-        for (size_t j = 0; j < HAMMING_N - HAMMING_K; j++) {
-            if (s[j] != H[j][i]) {
-                matching = 0;
-                break;
-            }
+// Four groups per iteration. The codewords of a group are byte swapped into a
+// big-endian 64-bit lane so hamming__pack's shift-and-mask steps apply as is,
+// and one pshufb then keeps the top 7 bytes of both lanes in stream order.
+// Returns the groups encoded.
+__attribute__((target("ssse3")))
+static size_t hamming__encode_groups_ssse3(const unsigned char *a, size_t groups, unsigned char *x) {
+    const __m128i swap = _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    const __m128i compact = _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 15, 14, 13, 12, 11, 10, 9, -1, -1);
+    unsigned char packed[32];
+    __m128i codewords[2];
+    size_t g = 0;
+    for (; g + 4 <= groups; g += 4) {
+        hamming__encode_bytes_ssse3(_mm_loadu_si128((const __m128i *)(a + g * HAMMING_GROUP_BYTES)), codewords);
+        for (size_t k = 0; k < 2; k++) {
+            __m128i y = _mm_shuffle_epi8(codewords[k], swap);
+            y = _mm_or_si128(_mm_and_si128(y, _mm_set1_epi64x(0xfe00fe00fe00fe00ll)),
+                             _mm_slli_epi64(_mm_and_si128(y, _mm_set1_epi64x(0x00fe00fe00fe00fell)), 1));
+            y = _mm_or_si128(_mm_and_si128(y, _mm_set1_epi64x(0xfffc0000fffc0000ll)),
+                             _mm_slli_epi64(_mm_and_si128(y, _mm_set1_epi64x(0x0000fffc0000fffcll)), 2));
+            y = _mm_or_si128(_mm_and_si128(y, _mm_set1_epi64x(0xfffffff000000000ll)),
+                             _mm_slli_epi64(_mm_and_si128(y, _mm_set1_epi64x(0x00000000fffffff0ll)), 4));
+            _mm_storeu_si128((__m128i *)(packed + 2 * HAMMING_GROUP_PACKED * k), _mm_shuffle_epi8(y, compact));
         }
+        memcpy(x + g * HAMMING_GROUP_PACKED, packed, 4 * HAMMING_GROUP_PACKED);
+    }
+    return g;
+}
 
-        if (matching == 1) {
-            index = i;
-            break;
+// The inverse: two groups are spread into big-endian lanes, unpacked with
+// hamming__unpack's steps and swapped back to codeword order. Returns the
+// groups decoded.
+__attribute__((target("ssse3")))
+static size_t hamming__decode_groups_ssse3(const unsigned char *x, size_t groups, unsigned char *a) {
+    const __m128i spread = _mm_setr_epi8(-1, 6, 5, 4, 3, 2, 1, 0, -1, 13, 12, 11, 10, 9, 8, 7);
+    const __m128i swap = _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    unsigned char packed[32];
+    __m128i codewords[2];
+    size_t g = 0;
+    for (; g + 4 <= groups; g += 4) {
+        memcpy(packed, x + g * HAMMING_GROUP_PACKED, 4 * HAMMING_GROUP_PACKED);
+        for (size_t k = 0; k < 2; k++) {
+            __m128i y = _mm_loadu_si128((const __m128i *)(packed + 2 * HAMMING_GROUP_PACKED * k));
+            y = _mm_shuffle_epi8(y, spread);
+            y = _mm_or_si128(_mm_and_si128(y, _mm_set1_epi64x(0xfffffff000000000ll)),
+                             _mm_and_si128(_mm_srli_epi64(y, 4), _mm_set1_epi64x(0x00000000fffffff0ll)));
+            y = _mm_or_si128(_mm_and_si128(y, _mm_set1_epi64x(0xfffc0000fffc0000ll)),
+                             _mm_and_si128(_mm_srli_epi64(y, 2), _mm_set1_epi64x(0x0000fffc0000fffcll)));
+            y = _mm_or_si128(_mm_and_si128(y, _mm_set1_epi64x(0xfe00fe00fe00fe00ll)),
+                             _mm_and_si128(_mm_srli_epi64(y, 1), _mm_set1_epi64x(0x00fe00fe00fe00fell)));
+            codewords[k] = _mm_shuffle_epi8(y, swap);
         }
+        _mm_storeu_si128((__m128i *)(a + g * HAMMING_GROUP_BYTES), hamming__decode_bytes_ssse3(codewords));
     }
+    return g;
+}
+#endif
+
+static void hamming__encode_groups(const unsigned char *a, size_t groups, unsigned char *x) {
+    size_t g = 0;
 
-    byte = byte ^ (1 << (HAMMING_N - index));
-    *nibble = (byte >> 4) & 0b00001111;
+#if defined(ECC_X86_DISPATCH)
+    if (__builtin_cpu_supports("ssse3")) {
+        g = hamming__encode_groups_ssse3(a, groups, x);
+    }
+#endif
+
+    for (; g < groups; g++) {
+        hamming__encode_group(a + g * HAMMING_GROUP_BYTES, x + g * HAMMING_GROUP_PACKED);
+    }
+}
+
+static void hamming__decode_groups(const unsigned char *x, size_t groups, unsigned char *a) {
+    size_t g = 0;
+
+#if defined(ECC_X86_DISPATCH)
+    if (__builtin_cpu_supports("ssse3")) {
+        g = hamming__decode_groups_ssse3(x, groups, a);
+    }
+#endif
+
+    for (; g < groups; g++) {
+        hamming__decode_group(x + g * HAMMING_GROUP_PACKED, a + g * HAMMING_GROUP_BYTES);
+    }
 }
 
 Ecc_Result hamming_encode(const unsigned char *a, unsigned long a_length, unsigned char **x, unsigned long *x_length) {
-    *x_length = a_length * 2;
+    *x_length = (a_length * 2 * 7 + 7) / 8;
     *x = malloc(*x_length * sizeof(unsigned char));
     if (*x == NULL) {
         return ECC_ERR;
     }
 
-    for (size_t i = 0; i < a_length; i++) {
-        unsigned char byte = a[i];
-
-        unsigned char high = (byte >> 4) & 0b00001111;
-        size_t high_index = i * 2;
-        hamming__helper_encode(high, &(*x)[high_index]);
+    size_t groups = a_length / HAMMING_GROUP_BYTES;
+    hamming__encode_groups(a, groups, *x);
 
-        unsigned char lower = byte & 0b00001111;
-        size_t lower_index = i * 2 + 1;
-        hamming__helper_encode(lower, &(*x)[lower_index]);
+    size_t rest = a_length - groups * HAMMING_GROUP_BYTES;
+    if (rest > 0) {
+        unsigned char tail_a[HAMMING_GROUP_BYTES] = {0};
+        unsigned char tail_x[HAMMING_GROUP_PACKED] = {0};
+        memcpy(tail_a, a + groups * HAMMING_GROUP_BYTES, rest);
+        hamming__encode_group(tail_a, tail_x);
+        memcpy(*x + groups * HAMMING_GROUP_PACKED, tail_x, *x_length - groups * HAMMING_GROUP_PACKED);
     }
 
     return ECC_OK;
 }
 
 Ecc_Result hamming_decode(const unsigned char *x, unsigned long x_length, unsigned char **a, unsigned long *a_length) {
-    *a_length = x_length / 2;
+    *a_length = x_length * 8 / 7 / 2;
     *a = malloc(*a_length * sizeof(unsigned char));
     if (*a == NULL) {
         return ECC_ERR;
     }
 
-    for (size_t i = 0; i < *a_length; i++) {
-        unsigned char high = 0;
-        size_t high_index = i * 2;
-        unsigned char high_byte = x[high_index];
-        hamming__helper_decode(high_byte, &high);
+    size_t groups = *a_length / HAMMING_GROUP_BYTES;
+    hamming__decode_groups(x, groups, *a);
+
+    size_t rest = *a_length - groups * HAMMING_GROUP_BYTES;
+    if (rest > 0) {
+        unsigned char tail_x[HAMMING_GROUP_PACKED] = {0};
+        unsigned char tail_a[HAMMING_GROUP_BYTES] = {0};
+        size_t available = x_length - groups * HAMMING_GROUP_PACKED;
+        memcpy(tail_x, x + groups * HAMMING_GROUP_PACKED, available < HAMMING_GROUP_PACKED ? available : HAMMING_GROUP_PACKED);
+        hamming__decode_group(tail_x, tail_a);
+        memcpy(*a + groups * HAMMING_GROUP_BYTES, tail_a, rest);
+    }
+
+    return ECC_OK;
+}
+
+#define RS_POLY 0x11d
+
+typedef struct {
+    size_t parity;
+    unsigned char exp[2 * RS_BLOCK];
+    unsigned char log[RS_BLOCK + 1];
+    // Generator polynomial, highest degree first (generator[0] = 1)
+    unsigned char generator[RS_MAX_PARITY + 1];
+    // Split tables: generator[j + 1] times n and times n << 4, one row per n
+    unsigned char gen_low[16][RS_MAX_PARITY];
+    unsigned char gen_high[16][RS_MAX_PARITY];
+    // Split tables of the Horner step alpha^(16 i) of syndrome i
+    unsigned char step_low[RS_MAX_PARITY][16];
+    unsigned char step_high[RS_MAX_PARITY][16];
+    // alpha^(i (15 - l)), the weight of lane l of syndrome i
+    unsigned char lane_weight[RS_MAX_PARITY][16];
+} Rs__Codec;
+
+static inline unsigned char rs__mul(const Rs__Codec *rs, unsigned char a, unsigned char b) {
+    if (a == 0 || b == 0) {
+        return 0;
+    }
+    return rs->exp[rs->log[a] + rs->log[b]];
+}
+
+static inline unsigned char rs__div(const Rs__Codec *rs, unsigned char a, unsigned char b) {
+    if (a == 0) {
+        return 0;
+    }
+    return rs->exp[rs->log[a] + RS_BLOCK - rs->log[b]];
+}
+
+// alpha^e for any e >= 0
+static inline unsigned char rs__pow(const Rs__Codec *rs, size_t e) {
+    return rs->exp[e % RS_BLOCK];
+}
+
+static void rs__init(Rs__Codec *rs, size_t parity) {
+    memset(rs, 0, sizeof(*rs));
+    rs->parity = parity;
+
+    unsigned int x = 1;
+    for (size_t i = 0; i < RS_BLOCK; i++) {
+        rs->exp[i] = (unsigned char)x;
+        rs->log[x] = (unsigned char)i;
+        x <<= 1;
+        if (x & 0x100) {
+            x ^= RS_POLY;
+        }
+    }
+    for (size_t i = RS_BLOCK; i < 2 * RS_BLOCK; i++) {
+        rs->exp[i] = rs->exp[i - RS_BLOCK];
+    }
+
+    // g(x) = (x + alpha^0)(x + alpha^1)...(x + alpha^(parity - 1))
+    rs->generator[0] = 1;
+    for (size_t i = 0; i < parity; i++) {
+        unsigned char root = rs->exp[i];
+        rs->generator[i + 1] = rs__mul(rs, rs->generator[i], root);
+        for (size_t j = i; j > 0; j--) {
+            rs->generator[j] ^= rs__mul(rs, rs->generator[j - 1], root);
+        }
+    }
+
+    for (size_t n = 0; n < 16; n++) {
+        for (size_t j = 0; j < parity; j++) {
+            rs->gen_low[n][j] = rs__mul(rs, rs->generator[j + 1], (unsigned char)n);
+            rs->gen_high[n][j] = rs__mul(rs, rs->generator[j + 1], (unsigned char)(n << 4));
+        }
+    }
+
+    for (size_t i = 0; i < parity; i++) {
+        unsigned char step = rs__pow(rs, 16 * i);
+        for (size_t n = 0; n < 16; n++) {
+            rs->step_low[i][n] = rs__mul(rs, step, (unsigned char)n);
+            rs->step_high[i][n] = rs__mul(rs, step, (unsigned char)(n << 4));
+            rs->lane_weight[i][n] = rs__pow(rs, i * (15 - n));
+        }
+    }
+}
+
+// Systematic encoding: the parity bytes are the remainder of data(x) x^parity
+// divided by g(x), kept in a shift register. Every data byte shifts it by one
+// and xors the row of generator multiples picked by the two nibbles of the
+// feedback byte.
+static void rs__encode_block(const Rs__Codec *rs, const unsigned char *data, unsigned char *block) {
+    size_t parity = rs->parity;
+    size_t k = RS_BLOCK - parity;
+    unsigned char remainder[RS_MAX_PARITY] = {0};
 
-        unsigned char lower = 0;
-        size_t lower_index = i * 2 + 1;
-        unsigned char lower_byte = x[lower_index];
-        hamming__helper_decode(lower_byte, &lower);
+#if defined(__SSE2__)
+    size_t regs = (parity + 15) / 16;
+    __m128i r[RS_MAX_PARITY / 16 + 1];
+    for (size_t q = 0; q <= regs; q++) {
+        r[q] = _mm_setzero_si128();
+    }
+
+    for (size_t i = 0; i < k; i++) {
+        unsigned char feedback = data[i] ^ (unsigned char)_mm_cvtsi128_si32(r[0]);
+        const unsigned char *low = rs->gen_low[feedback & 0x0f];
+        const unsigned char *high = rs->gen_high[feedback >> 4];
+        for (size_t q = 0; q < regs; q++) {
+            __m128i shifted = _mm_or_si128(_mm_srli_si128(r[q], 1), _mm_slli_si128(r[q + 1], 15));
+            __m128i row = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(low + 16 * q)),
+                                        _mm_loadu_si128((const __m128i *)(high + 16 * q)));
+            r[q] = _mm_xor_si128(shifted, row);
+        }
+    }
+
+    for (size_t q = 0; q < regs; q++) {
+        _mm_storeu_si128((__m128i *)(remainder + 16 * q), r[q]);
+    }
+#else
+    for (size_t i = 0; i < k; i++) {
+        unsigned char feedback = data[i] ^ remainder[0];
+        const unsigned char *low = rs->gen_low[feedback & 0x0f];
+        const unsigned char *high = rs->gen_high[feedback >> 4];
+        memmove(remainder, remainder + 1, parity - 1);
+        remainder[parity - 1] = 0;
+        for (size_t j = 0; j < parity; j++) {
+            remainder[j] ^= low[j] ^ high[j];
+        }
+    }
+#endif
+
+    memcpy(block, data, k);
+    memcpy(block + k, remainder, parity);
+}
 
-        (*a)[i] = (high << 4) | lower;
+#if defined(ECC_X86_DISPATCH)
+// The Horner lanes of rs__syndromes, one multiplication by a constant being
+// two pshufb on the nibbles
+__attribute__((target("ssse3")))
+static void rs__syndrome_lanes_ssse3(const unsigned char step_low[16], const unsigned char step_high[16],
+                                     const unsigned char *padded, unsigned char acc[16]) {
+    const __m128i low = _mm_loadu_si128((const __m128i *)step_low);
+    const __m128i high = _mm_loadu_si128((const __m128i *)step_high);
+    const __m128i low_mask = _mm_set1_epi8(0x0f);
+    __m128i v = _mm_setzero_si128();
+    for (size_t c = 0; c < RS_BLOCK + 1; c += 16) {
+        __m128i product = _mm_xor_si128(_mm_shuffle_epi8(low, _mm_and_si128(v, low_mask)),
+                                        _mm_shuffle_epi8(high, _mm_and_si128(_mm_srli_epi16(v, 4), low_mask)));
+        v = _mm_xor_si128(product, _mm_loadu_si128((const __m128i *)(padded + c)));
+    }
+    _mm_storeu_si128((__m128i *)acc, v);
+}
+#endif
+
+// S_i = r(alpha^i). With a leading zero the block is 256 bytes, evaluated as
+// 16 interleaved Horner lanes that all step by alpha^(16 i), so every step is
+// one multiplication of 16 bytes by a constant
+static void rs__syndromes(const Rs__Codec *rs, const unsigned char *block, unsigned char *syndromes) {
+    unsigned char padded[RS_BLOCK + 1];
+    padded[0] = 0;
+    memcpy(padded + 1, block, RS_BLOCK);
+
+#if defined(ECC_X86_DISPATCH)
+    int ssse3 = __builtin_cpu_supports("ssse3");
+#else
+    int ssse3 = 0;
+#endif
+
+    for (size_t i = 0; i < rs->parity; i++) {
+        unsigned char acc[16] = {0};
+        if (ssse3) {
+#if defined(ECC_X86_DISPATCH)
+            rs__syndrome_lanes_ssse3(rs->step_low[i], rs->step_high[i], padded, acc);
+#endif
+        } else {
+            for (size_t c = 0; c < RS_BLOCK + 1; c += 16) {
+                for (size_t l = 0; l < 16; l++) {
+                    acc[l] = rs->step_low[i][acc[l] & 0x0f] ^ rs->step_high[i][acc[l] >> 4] ^ padded[c + l];
+                }
+            }
+        }
+
+        unsigned char s = 0;
+        for (size_t l = 0; l < 16; l++) {
+            s ^= rs__mul(rs, acc[l], rs->lane_weight[i][l]);
+        }
+        syndromes[i] = s;
+    }
+}
+
+// Berlekamp-Massey for the error locator, Chien search for its roots and
+// Forney for the magnitudes. Returns ECC_ERR when the block has more errors
+// than the code corrects, leaving it untouched.
+static Ecc_Result rs__decode_block(const Rs__Codec *rs, unsigned char *block) {
+    size_t parity = rs->parity;
+    unsigned char syndromes[RS_MAX_PARITY];
+    rs__syndromes(rs, block, syndromes);
+
+    int clean = 1;
+    for (size_t i = 0; i < parity; i++) {
+        if (syndromes[i] != 0) {
+            clean = 0;
+            break;
+        }
+    }
+    if (clean) {
+        return ECC_OK;
+    }
+
+    // Polynomials below are lowest degree first
+    unsigned char locator[RS_MAX_PARITY + 1] = {1};
+    unsigned char previous[RS_MAX_PARITY + 1] = {1};
+    size_t degree = 0;
+    size_t shift = 1;
+    unsigned char last_discrepancy = 1;
+    for (size_t n = 0; n < parity; n++) {
+        unsigned char discrepancy = syndromes[n];
+        for (size_t i = 1; i <= degree; i++) {
+            discrepancy ^= rs__mul(rs, locator[i], syndromes[n - i]);
+        }
+
+        if (discrepancy == 0) {
+            shift++;
+            continue;
+        }
+
+        unsigned char scale = rs__div(rs, discrepancy, last_discrepancy);
+        unsigned char saved[RS_MAX_PARITY + 1];
+        memcpy(saved, locator, sizeof(saved));
+        for (size_t i = 0; i + shift <= parity; i++) {
+            locator[i + shift] ^= rs__mul(rs, scale, previous[i]);
+        }
+
+        if (2 * degree <= n) {
+            degree = n + 1 - degree;
+            memcpy(previous, saved, sizeof(previous));
+            last_discrepancy = discrepancy;
+            shift = 1;
+        } else {
+            shift++;
+        }
+    }
+
+    if (2 * degree > parity) {
+        return ECC_ERR;
+    }
+
+    // Omega(x) = S(x) Lambda(x) mod x^parity
+    unsigned char evaluator[RS_MAX_PARITY] = {0};
+    for (size_t k = 0; k < parity; k++) {
+        for (size_t t = 0; t <= degree && t <= k; t++) {
+            evaluator[k] ^= rs__mul(rs, locator[t], syndromes[k - t]);
+        }
+    }
+
+    // Chien search: terms[t] = Lambda_t alpha^(-p t), stepped along with p
+    unsigned char terms[RS_MAX_PARITY + 1];
+    memcpy(terms, locator, degree + 1);
+
+    size_t positions[RS_MAX_PARITY];
+    unsigned char magnitudes[RS_MAX_PARITY];
+    size_t found = 0;
+    for (size_t p = 0; p < RS_BLOCK; p++) {
+        unsigned char value = 0;
+        for (size_t t = 0; t <= degree; t++) {
+            value ^= terms[t];
+        }
+        for (size_t t = 1; t <= degree; t++) {
+            terms[t] = rs__mul(rs, terms[t], rs->exp[RS_BLOCK - t]);
+        }
+        if (value != 0) {
+            continue;
+        }
+        if (found == degree) {
+            return ECC_ERR;
+        }
+
+        // X^-1 = alpha^-p
+        size_t inv = (RS_BLOCK - p) % RS_BLOCK;
+        unsigned char numerator = 0;
+        for (size_t k = 0; k < parity; k++) {
+            numerator ^= rs__mul(rs, evaluator[k], rs__pow(rs, inv * k));
+        }
+        unsigned char denominator = 0;
+        for (size_t t = 1; t <= degree; t += 2) {
+            denominator ^= rs__mul(rs, locator[t], rs__pow(rs, inv * (t - 1)));
+        }
+        if (denominator == 0) {
+            return ECC_ERR;
+        }
+
+        positions[found] = RS_BLOCK - 1 - p;
+        magnitudes[found] = rs__mul(rs, rs__pow(rs, p), rs__div(rs, numerator, denominator));
+        found++;
+    }
+
+    if (found != degree) {
+        return ECC_ERR;
+    }
+
+    for (size_t i = 0; i < found; i++) {
+        block[positions[i]] ^= magnitudes[i];
     }
 
     return ECC_OK;
 }
+
+// Frames: depth codeword units (a packed Hamming group of 8 codewords, or a
+// Reed-Solomon block) are encoded as the rows of a matrix that is emitted
+// column by column, so a burst of up to depth consecutive bytes touches each
+// codeword at most once. The transposes go tile by tile to stay in cache.
+#define ECC_TILE 16
+
+struct Ecc_Codec {
+    Ecc_Options options;
+    Rs__Codec rs;
+    size_t unit_data;
+    size_t unit_code;
+    unsigned char *rows;   // One frame of codewords, row by row
+    unsigned char *padded; // The zero padded data of a last partial frame
+};
+
+// y[c * rows + r] = x[r * columns + c]
+static void ecc__transpose(const unsigned char *x, size_t rows, size_t columns, unsigned char *y) {
+    for (size_t r0 = 0; r0 < rows; r0 += ECC_TILE) {
+        size_t r1 = r0 + ECC_TILE < rows ? r0 + ECC_TILE : rows;
+        for (size_t c0 = 0; c0 < columns; c0 += ECC_TILE) {
+            size_t c1 = c0 + ECC_TILE < columns ? c0 + ECC_TILE : columns;
+            for (size_t r = r0; r < r1; r++) {
+                for (size_t c = c0; c < c1; c++) {
+                    y[c * rows + r] = x[r * columns + c];
+                }
+            }
+        }
+    }
+}
+
+Ecc_Result ecc_codec_new(const Ecc_Options *options, Ecc_Codec **codec) {
+    *codec = NULL;
+
+    if (options->depth == 0 || options->depth > ECC_MAX_DEPTH) {
+        return ECC_ERR;
+    }
+    if (options->code == ECC_RS && (options->parity == 0 || options->parity > RS_MAX_PARITY)) {
+        return ECC_ERR;
+    }
+    if (options->code != ECC_HAMMING && options->code != ECC_RS) {
+        return ECC_ERR;
+    }
+
+    Ecc_Codec *c = malloc(sizeof(Ecc_Codec));
+    if (c == NULL) {
+        return ECC_ERR;
+    }
+    c->options = *options;
+
+    if (options->code == ECC_HAMMING) {
+        c->unit_data = HAMMING_GROUP_BYTES;
+        c->unit_code = HAMMING_GROUP_PACKED;
+    } else {
+        rs__init(&c->rs, options->parity);
+        c->unit_data = RS_BLOCK - options->parity;
+        c->unit_code = RS_BLOCK;
+    }
+
+    c->rows = malloc(options->depth * c->unit_code * sizeof(unsigned char));
+    c->padded = malloc(options->depth * c->unit_data * sizeof(unsigned char));
+    if (c->rows == NULL || c->padded == NULL) {
+        ecc_codec_free(c);
+        return ECC_ERR;
+    }
+
+    *codec = c;
+    return ECC_OK;
+}
+
+void ecc_codec_free(Ecc_Codec *codec) {
+    if (codec == NULL) {
+        return;
+    }
+    free(codec->rows);
+    free(codec->padded);
+    free(codec);
+}
+
+unsigned long ecc_frame_data(const Ecc_Codec *codec) {
+    return codec->options.depth * codec->unit_data;
+}
+
+unsigned long ecc_frame_code(const Ecc_Codec *codec) {
+    return codec->options.depth * codec->unit_code;
+}
+
+static void ecc__encode_units(Ecc_Codec *codec, const unsigned char *data, size_t units, unsigned char *code) {
+    if (codec->options.code == ECC_HAMMING) {
+        hamming__encode_groups(data, units, code);
+        return;
+    }
+    for (size_t u = 0; u < units; u++) {
+        rs__encode_block(&codec->rs, data + u * codec->unit_data, code + u * codec->unit_code);
+    }
+}
+
+// Decodes units in place, returns how many could not be corrected
+static size_t ecc__decode_units(Ecc_Codec *codec, unsigned char *code, size_t units, unsigned char *data) {
+    if (codec->options.code == ECC_HAMMING) {
+        hamming__decode_groups(code, units, data);
+        return 0;
+    }
+
+    size_t failures = 0;
+    for (size_t u = 0; u < units; u++) {
+        unsigned char *block = code + u * codec->unit_code;
+        if (rs__decode_block(&codec->rs, block) != ECC_OK) {
+            failures++;
+        }
+        memcpy(data + u * codec->unit_data, block, codec->unit_data);
+    }
+    return failures;
+}
+
+static void ecc__encode_whole_frames(Ecc_Codec *codec, const unsigned char *data, size_t frames, unsigned char *code) {
+    size_t depth = codec->options.depth;
+    if (depth == 1) {
+        // Nothing to interleave, so all the units go through in one run
+        ecc__encode_units(codec, data, frames, code);
+        return;
+    }
+
+    for (size_t f = 0; f < frames; f++) {
+        ecc__encode_units(codec, data + f * ecc_frame_data(codec), depth, codec->rows);
+        ecc__transpose(codec->rows, depth, codec->unit_code, code + f * ecc_frame_code(codec));
+    }
+}
+
+void ecc_encode_frames(Ecc_Codec *codec, const unsigned char *data, unsigned long count, unsigned char *code) {
+    size_t frame_data = ecc_frame_data(codec);
+    size_t frames = count / frame_data;
+    ecc__encode_whole_frames(codec, data, frames, code);
+
+    size_t rest = count - frames * frame_data;
+    if (rest > 0) {
+        memset(codec->padded, 0, frame_data);
+        memcpy(codec->padded, data + frames * frame_data, rest);
+        ecc__encode_whole_frames(codec, codec->padded, 1, code + frames * ecc_frame_code(codec));
+    }
+}
+
+unsigned long ecc_decode_frames(Ecc_Codec *codec, const unsigned char *code, unsigned long frames, unsigned char *data) {
+    size_t depth = codec->options.depth;
+    if (depth == 1 && codec->options.code == ECC_HAMMING) {
+        hamming__decode_groups(code, frames, data);
+        return 0;
+    }
+
+    size_t failures = 0;
+    for (size_t f = 0; f < frames; f++) {
+        const unsigned char *frame = code + f * ecc_frame_code(codec);
+        if (depth > 1) {
+            ecc__transpose(frame, codec->unit_code, depth, codec->rows);
+        } else {
+            memcpy(codec->rows, frame, codec->unit_code);
+        }
+        failures += ecc__decode_units(codec, codec->rows, depth, data + f * ecc_frame_data(codec));
+    }
+
+    return failures;
+}
+
+// CRC32C (Castagnoli, reflected polynomial 0x82f63b78) of every byte value
+static const uint32_t CRC32C_TABLE[256] = {
+    0x00000000, 0xf26b8303, 0xe13b70f7, 0x1350f3f4, 0xc79a971f, 0x35f1141c, 0x26a1e7e8, 0xd4ca64eb,
+    0x8ad958cf, 0x78b2dbcc, 0x6be22838, 0x9989ab3b, 0x4d43cfd0, 0xbf284cd3, 0xac78bf27, 0x5e133c24,
+    0x105ec76f, 0xe235446c, 0xf165b798, 0x030e349b, 0xd7c45070, 0x25afd373, 0x36ff2087, 0xc494a384,
+    0x9a879fa0, 0x68ec1ca3, 0x7bbcef57, 0x89d76c54, 0x5d1d08bf, 0xaf768bbc, 0xbc267848, 0x4e4dfb4b,
+    0x20bd8ede, 0xd2d60ddd, 0xc186fe29, 0x33ed7d2a, 0xe72719c1, 0x154c9ac2, 0x061c6936, 0xf477ea35,
+    0xaa64d611, 0x580f5512, 0x4b5fa6e6, 0xb93425e5, 0x6dfe410e, 0x9f95c20d, 0x8cc531f9, 0x7eaeb2fa,
+    0x30e349b1, 0xc288cab2, 0xd1d83946, 0x23b3ba45, 0xf779deae, 0x05125dad, 0x1642ae59, 0xe4292d5a,
+    0xba3a117e, 0x4851927d, 0x5b016189, 0xa96ae28a, 0x7da08661, 0x8fcb0562, 0x9c9bf696, 0x6ef07595,
+    0x417b1dbc, 0xb3109ebf, 0xa0406d4b, 0x522bee48, 0x86e18aa3, 0x748a09a0, 0x67dafa54, 0x95b17957,
+    0xcba24573, 0x39c9c670, 0x2a993584, 0xd8f2b687, 0x0c38d26c, 0xfe53516f, 0xed03a29b, 0x1f682198,
+    0x5125dad3, 0xa34e59d0, 0xb01eaa24, 0x42752927, 0x96bf4dcc, 0x64d4cecf, 0x77843d3b, 0x85efbe38,
+    0xdbfc821c, 0x2997011f, 0x3ac7f2eb, 0xc8ac71e8, 0x1c661503, 0xee0d9600, 0xfd5d65f4, 0x0f36e6f7,
+    0x61c69362, 0x93ad1061, 0x80fde395, 0x72966096, 0xa65c047d, 0x5437877e, 0x4767748a, 0xb50cf789,
+    0xeb1fcbad, 0x197448ae, 0x0a24bb5a, 0xf84f3859, 0x2c855cb2, 0xdeeedfb1, 0xcdbe2c45, 0x3fd5af46,
+    0x7198540d, 0x83f3d70e, 0x90a324fa, 0x62c8a7f9, 0xb602c312, 0x44694011, 0x5739b3e5, 0xa55230e6,
+    0xfb410cc2, 0x092a8fc1, 0x1a7a7c35, 0xe811ff36, 0x3cdb9bdd, 0xceb018de, 0xdde0eb2a, 0x2f8b6829,
+    0x82f63b78, 0x709db87b, 0x63cd4b8f, 0x91a6c88c, 0x456cac67, 0xb7072f64, 0xa457dc90, 0x563c5f93,
+    0x082f63b7, 0xfa44e0b4, 0xe9141340, 0x1b7f9043, 0xcfb5f4a8, 0x3dde77ab, 0x2e8e845f, 0xdce5075c,
+    0x92a8fc17, 0x60c37f14, 0x73938ce0, 0x81f80fe3, 0x55326b08, 0xa759e80b, 0xb4091bff, 0x466298fc,
+    0x1871a4d8, 0xea1a27db, 0xf94ad42f, 0x0b21572c, 0xdfeb33c7, 0x2d80b0c4, 0x3ed04330, 0xccbbc033,
+    0xa24bb5a6, 0x502036a5, 0x4370c551, 0xb11b4652, 0x65d122b9, 0x97baa1ba, 0x84ea524e, 0x7681d14d,
+    0x2892ed69, 0xdaf96e6a, 0xc9a99d9e, 0x3bc21e9d, 0xef087a76, 0x1d63f975, 0x0e330a81, 0xfc588982,
+    0xb21572c9, 0x407ef1ca, 0x532e023e, 0xa145813d, 0x758fe5d6, 0x87e466d5, 0x94b49521, 0x66df1622,
+    0x38cc2a06, 0xcaa7a905, 0xd9f75af1, 0x2b9cd9f2, 0xff56bd19, 0x0d3d3e1a, 0x1e6dcdee, 0xec064eed,
+    0xc38d26c4, 0x31e6a5c7, 0x22b65633, 0xd0ddd530, 0x0417b1db, 0xf67c32d8, 0xe52cc12c, 0x1747422f,
+    0x49547e0b, 0xbb3ffd08, 0xa86f0efc, 0x5a048dff, 0x8ecee914, 0x7ca56a17, 0x6ff599e3, 0x9d9e1ae0,
+    0xd3d3e1ab, 0x21b862a8, 0x32e8915c, 0xc083125f, 0x144976b4, 0xe622f5b7, 0xf5720643, 0x07198540,
+    0x590ab964, 0xab613a67, 0xb831c993, 0x4a5a4a90, 0x9e902e7b, 0x6cfbad78, 0x7fab5e8c, 0x8dc0dd8f,
+    0xe330a81a, 0x115b2b19, 0x020bd8ed, 0xf0605bee, 0x24aa3f05, 0xd6c1bc06, 0xc5914ff2, 0x37faccf1,
+    0x69e9f0d5, 0x9b8273d6, 0x88d28022, 0x7ab90321, 0xae7367ca, 0x5c18e4c9, 0x4f48173d, 0xbd23943e,
+    0xf36e6f75, 0x0105ec76, 0x12551f82, 0xe03e9c81, 0x34f4f86a, 0xc69f7b69, 0xd5cf889d, 0x27a40b9e,
+    0x79b737ba, 0x8bdcb4b9, 0x988c474d, 0x6ae7c44e, 0xbe2da0a5, 0x4c4623a6, 0x5f16d052, 0xad7d5351,
+};
+
+#if defined(ECC_X86_DISPATCH)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c__sse42(uint32_t crc, const unsigned char *data, unsigned long length) {
+    size_t i = 0;
+#if defined(__x86_64__)
+    uint64_t crc64 = crc;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (uint32_t)crc64;
+#else
+    for (; i + 4 <= length; i += 4) {
+        uint32_t word;
+        memcpy(&word, data + i, sizeof(word));
+        crc = _mm_crc32_u32(crc, word);
+    }
+#endif
+    for (; i < length; i++) {
+        crc = _mm_crc32_u8(crc, data[i]);
+    }
+    return crc;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const unsigned char *data, unsigned long length) {
+    size_t i = 0;
+    crc = ~crc;
+
+#if defined(ECC_X86_DISPATCH)
+    if (__builtin_cpu_supports("sse4.2")) {
+        return ~crc32c__sse42(crc, data, length);
+    }
+#elif defined(__ARM_FEATURE_CRC32)
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        crc = __crc32cd(crc, word);
+    }
+#endif
+
+    for (; i < length; i++) {
+        crc = CRC32C_TABLE[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
@@ -1,12 +1,57 @@
 #ifndef ERROR_H
 #define ERROR_H
 
+#include <stdint.h>
+
 typedef enum {
     ECC_OK = 0,
     ECC_ERR = 1,
 } Ecc_Result;
 
+// Hamming(7,4), with the 7-bit codewords packed back to back (8 codewords in
+// 7 bytes, most significant bit first)
 Ecc_Result hamming_encode(const unsigned char *a, unsigned long a_length, unsigned char **x, unsigned long *x_length);
 Ecc_Result hamming_decode(const unsigned char *x, unsigned long x_length, unsigned char **a, unsigned long *a_length);
 
+// Reed-Solomon over GF(256) in 255 byte blocks of 255 - parity data bytes
+// followed by parity check bytes; each block corrects up to parity / 2 byte
+// errors
+#define RS_BLOCK 255
+#define RS_MAX_PARITY 128
+
+typedef enum {
+    ECC_HAMMING = 0,
+    ECC_RS = 1,
+} Ecc_Code;
+
+#define ECC_MAX_DEPTH 1024
+
+typedef struct {
+    Ecc_Code code;
+    unsigned long parity; // Reed-Solomon parity bytes per block
+    unsigned long depth;  // Codeword units interleaved per frame (1: no interleaving)
+} Ecc_Options;
+
+// Codes in frames of depth units (8 packed Hamming codewords, or a
+// Reed-Solomon block) interleaved byte by byte, so a burst of up to depth
+// consecutive bytes hits each codeword at most once. Callers produce or
+// consume the stream any number of frames at a time.
+typedef struct Ecc_Codec Ecc_Codec;
+
+Ecc_Result ecc_codec_new(const Ecc_Options *options, Ecc_Codec **codec);
+void ecc_codec_free(Ecc_Codec *codec);
+// Data and code bytes in one frame
+unsigned long ecc_frame_data(const Ecc_Codec *codec);
+unsigned long ecc_frame_code(const Ecc_Codec *codec);
+// Encodes count data bytes into whole frames, the last one zero padded up to
+// ecc_frame_data
+void ecc_encode_frames(Ecc_Codec *codec, const unsigned char *data, unsigned long count, unsigned char *code);
+// Decodes frames frames, returns the number of units that could not be
+// corrected. Those are left as received.
+unsigned long ecc_decode_frames(Ecc_Codec *codec, const unsigned char *code, unsigned long frames, unsigned char *data);
+
+// CRC32C of data, continuing from crc (0 to start). Uses the SSE4.2 crc32
+// instruction when the CPU has it, or the ARMv8 one when the build targets it.
+uint32_t crc32c(uint32_t crc, const unsigned char *data, unsigned long length);
+
 #endif // ERROR_H
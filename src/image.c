@@ -0,0 +1,388 @@
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+// The SSSE3 (pshufb) kernels are compiled with a function target attribute
+// and picked at run time, so the default build uses them without -m flags
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define IMAGE_X86_DISPATCH
+#include <tmmintrin.h>
+#endif
+
+#include "image.h"
+
+// Pixels converted per step, small enough for the byte tiles to stay in L1
+#define IMAGE_TILE 256
+
+Image_Result image_planes_alloc(Image_Planes *image, size_t width, size_t height, size_t num_chan) {
+    memset(image, 0, sizeof(Image_Planes));
+    if (num_chan == 0 || num_chan > IMAGE_MAX_CHANNELS) {
+        return IMAGE_ERR;
+    }
+
+    image->width = width;
+    image->height = height;
+    image->num_chan = num_chan;
+
+    size_t size = width * height * sizeof(double);
+    size = (size + IMAGE_ALIGNMENT - 1) / IMAGE_ALIGNMENT * IMAGE_ALIGNMENT;
+    for (size_t c = 0; c < num_chan; c++) {
+        image->planes[c] = aligned_alloc(IMAGE_ALIGNMENT, size);
+        if (image->planes[c] == NULL) {
+            image_planes_free(image);
+            return IMAGE_ERR;
+        }
+    }
+
+    return IMAGE_OK;
+}
+
+void image_planes_free(Image_Planes *image) {
+    for (size_t c = 0; c < IMAGE_MAX_CHANNELS; c++) {
+        if (image->planes[c] != NULL) {
+            free(image->planes[c]);
+            image->planes[c] = NULL;
+        }
+    }
+}
+
+void image_normalize(const uint8_t *bytes, size_t count, double *x) {
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128d scale = _mm_set1_pd(255.0);
+    for (; i + 16 <= count; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(bytes + i));
+        __m128i lo = _mm_unpacklo_epi8(v, zero);
+        __m128i hi = _mm_unpackhi_epi8(v, zero);
+        __m128i q[4] = {
+            _mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero),
+            _mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero),
+        };
+        for (size_t k = 0; k < 4; k++) {
+            __m128d a = _mm_cvtepi32_pd(q[k]);
+            __m128d b = _mm_cvtepi32_pd(_mm_shuffle_epi32(q[k], _MM_SHUFFLE(1, 0, 3, 2)));
+            _mm_storeu_pd(x + i + 4 * k, _mm_div_pd(a, scale));
+            _mm_storeu_pd(x + i + 4 * k + 2, _mm_div_pd(b, scale));
+        }
+    }
+#endif
+
+    for (; i < count; i++) {
+        x[i] = (double)bytes[i] / 255.0;
+    }
+}
+
+void image_denormalize(const double *x, size_t count, uint8_t *bytes) {
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128d scale = _mm_set1_pd(255.0);
+    const __m128d low = _mm_set1_pd(0.0);
+    const __m128d high = _mm_set1_pd(255.0);
+    for (; i + 8 <= count; i += 8) {
+        __m128i d[4];
+        for (size_t k = 0; k < 4; k++) {
+            // max_pd returns its second operand for NaN, like fmax
+            __m128d v = _mm_mul_pd(_mm_loadu_pd(x + i + 2 * k), scale);
+            v = _mm_min_pd(_mm_max_pd(v, low), high);
+            d[k] = _mm_cvttpd_epi32(v);
+        }
+        __m128i a = _mm_unpacklo_epi64(d[0], d[1]);
+        __m128i b = _mm_unpacklo_epi64(d[2], d[3]);
+        __m128i w = _mm_packs_epi32(a, b);
+        _mm_storel_epi64((__m128i *)(bytes + i), _mm_packus_epi16(w, w));
+    }
+#endif
+
+    for (; i < count; i++) {
+        double v = x[i] * 255.0;
+        v = v > 0.0 ? v : 0.0;
+        v = v < 255.0 ? v : 255.0;
+        bytes[i] = (uint8_t)v;
+    }
+}
+
+void image_to_samples(const uint8_t *bytes, size_t count, int16_t *samples) {
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i center = _mm_set1_epi16(128);
+    for (; i + 16 <= count; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(bytes + i));
+        _mm_storeu_si128((__m128i *)(samples + i), _mm_sub_epi16(_mm_unpacklo_epi8(v, zero), center));
+        _mm_storeu_si128((__m128i *)(samples + i + 8), _mm_sub_epi16(_mm_unpackhi_epi8(v, zero), center));
+    }
+#endif
+
+    for (; i < count; i++) {
+        samples[i] = (int16_t)bytes[i] - 128;
+    }
+}
+
+void image_from_samples(const int16_t *samples, size_t count, uint8_t *bytes) {
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128i center = _mm_set1_epi16(128);
+    for (; i + 16 <= count; i += 16) {
+        __m128i lo = _mm_adds_epi16(_mm_loadu_si128((const __m128i *)(samples + i)), center);
+        __m128i hi = _mm_adds_epi16(_mm_loadu_si128((const __m128i *)(samples + i + 8)), center);
+        _mm_storeu_si128((__m128i *)(bytes + i), _mm_packus_epi16(lo, hi));
+    }
+#endif
+
+    for (; i < count; i++) {
+        int v = samples[i] + 128;
+        bytes[i] = v < 0 ? 0 : v > 255 ? 255 : (uint8_t)v;
+    }
+}
+
+#if defined(IMAGE_X86_DISPATCH)
+// pshufb masks moving the bytes of channel c found in source register r
+// (16 * num_chan interleaved bytes span num_chan registers) to their planar lane
+__attribute__((target("ssse3")))
+static void image__deinterleave_masks(size_t num_chan, __m128i masks[IMAGE_MAX_CHANNELS][IMAGE_MAX_CHANNELS]) {
+    for (size_t c = 0; c < num_chan; c++) {
+        for (size_t r = 0; r < num_chan; r++) {
+            uint8_t mask[16];
+            for (size_t k = 0; k < 16; k++) {
+                size_t src = num_chan * k + c;
+                mask[k] = src / 16 == r ? (uint8_t)(src % 16) : 0x80;
+            }
+            masks[c][r] = _mm_loadu_si128((const __m128i *)mask);
+        }
+    }
+}
+
+// pshufb masks moving the planar lanes of channel c to their place in the
+// interleaved output register r
+__attribute__((target("ssse3")))
+static void image__interleave_masks(size_t num_chan, __m128i masks[IMAGE_MAX_CHANNELS][IMAGE_MAX_CHANNELS]) {
+    for (size_t c = 0; c < num_chan; c++) {
+        for (size_t r = 0; r < num_chan; r++) {
+            uint8_t mask[16];
+            for (size_t j = 0; j < 16; j++) {
+                size_t dst = 16 * r + j;
+                mask[j] = dst % num_chan == c ? (uint8_t)(dst / num_chan) : 0x80;
+            }
+            masks[c][r] = _mm_loadu_si128((const __m128i *)mask);
+        }
+    }
+}
+
+// Returns the pixels converted, a multiple of 16
+__attribute__((target("ssse3")))
+static size_t image__deinterleave_ssse3(const uint8_t *bytes, size_t count, size_t num_chan,
+                                        uint8_t tiles[IMAGE_MAX_CHANNELS][IMAGE_TILE]) {
+    __m128i masks[IMAGE_MAX_CHANNELS][IMAGE_MAX_CHANNELS];
+    image__deinterleave_masks(num_chan, masks);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i src[IMAGE_MAX_CHANNELS];
+        for (size_t r = 0; r < num_chan; r++) {
+            src[r] = _mm_loadu_si128((const __m128i *)(bytes + i * num_chan + 16 * r));
+        }
+        for (size_t c = 0; c < num_chan; c++) {
+            __m128i v = _mm_shuffle_epi8(src[0], masks[c][0]);
+            for (size_t r = 1; r < num_chan; r++) {
+                v = _mm_or_si128(v, _mm_shuffle_epi8(src[r], masks[c][r]));
+            }
+            _mm_storeu_si128((__m128i *)(tiles[c] + i), v);
+        }
+    }
+    return i;
+}
+
+__attribute__((target("ssse3")))
+static size_t image__interleave_ssse3(uint8_t tiles[IMAGE_MAX_CHANNELS][IMAGE_TILE], size_t count, size_t num_chan,
+                                      uint8_t *bytes) {
+    __m128i masks[IMAGE_MAX_CHANNELS][IMAGE_MAX_CHANNELS];
+    image__interleave_masks(num_chan, masks);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i src[IMAGE_MAX_CHANNELS];
+        for (size_t c = 0; c < num_chan; c++) {
+            src[c] = _mm_loadu_si128((const __m128i *)(tiles[c] + i));
+        }
+        for (size_t r = 0; r < num_chan; r++) {
+            __m128i v = _mm_shuffle_epi8(src[0], masks[0][r]);
+            for (size_t c = 1; c < num_chan; c++) {
+                v = _mm_or_si128(v, _mm_shuffle_epi8(src[c], masks[c][r]));
+            }
+            _mm_storeu_si128((__m128i *)(bytes + i * num_chan + 16 * r), v);
+        }
+    }
+    return i;
+}
+#endif
+
+static void image__deinterleave(const uint8_t *bytes, size_t count, size_t num_chan,
+                                uint8_t tiles[IMAGE_MAX_CHANNELS][IMAGE_TILE]) {
+    size_t i = 0;
+
+#if defined(IMAGE_X86_DISPATCH)
+    if (num_chan > 1 && __builtin_cpu_supports("ssse3")) {
+        i = image__deinterleave_ssse3(bytes, count, num_chan, tiles);
+    }
+#endif
+
+    for (; i < count; i++) {
+        for (size_t c = 0; c < num_chan; c++) {
+            tiles[c][i] = bytes[i * num_chan + c];
+        }
+    }
+}
+
+static void image__interleave(uint8_t tiles[IMAGE_MAX_CHANNELS][IMAGE_TILE], size_t count, size_t num_chan,
+                              uint8_t *bytes) {
+    size_t i = 0;
+
+#if defined(IMAGE_X86_DISPATCH)
+    if (num_chan > 1 && __builtin_cpu_supports("ssse3")) {
+        i = image__interleave_ssse3(tiles, count, num_chan, bytes);
+    }
+#endif
+
+    for (; i < count; i++) {
+        for (size_t c = 0; c < num_chan; c++) {
+            bytes[i * num_chan + c] = tiles[c][i];
+        }
+    }
+}
+
+void image_planes_from_bytes(Image_Planes *image, const uint8_t *bytes) {
+    size_t count = image->width * image->height;
+    size_t num_chan = image->num_chan;
+
+    if (num_chan == 1) {
+        image_normalize(bytes, count, image->planes[0]);
+        return;
+    }
+
+    uint8_t tiles[IMAGE_MAX_CHANNELS][IMAGE_TILE];
+    for (size_t i = 0; i < count; i += IMAGE_TILE) {
+        size_t n = count - i < IMAGE_TILE ? count - i : IMAGE_TILE;
+        image__deinterleave(bytes + i * num_chan, n, num_chan, tiles);
+        for (size_t c = 0; c < num_chan; c++) {
+            image_normalize(tiles[c], n, image->planes[c] + i);
+        }
+    }
+}
+
+void image_planes_to_bytes(const Image_Planes *image, uint8_t *bytes) {
+    size_t count = image->width * image->height;
+    size_t num_chan = image->num_chan;
+
+    if (num_chan == 1) {
+        image_denormalize(image->planes[0], count, bytes);
+        return;
+    }
+
+    uint8_t tiles[IMAGE_MAX_CHANNELS][IMAGE_TILE];
+    for (size_t i = 0; i < count; i += IMAGE_TILE) {
+        size_t n = count - i < IMAGE_TILE ? count - i : IMAGE_TILE;
+        for (size_t c = 0; c < num_chan; c++) {
+            image_denormalize(image->planes[c] + i, n, tiles[c]);
+        }
+        image__interleave(tiles, n, num_chan, bytes + i * num_chan);
+    }
+}
+
+void image_planes_channel_to_bytes(const Image_Planes *image, size_t channel, uint8_t *bytes) {
+    size_t count = image->width * image->height;
+    size_t num_chan = image->num_chan;
+
+    uint8_t tile[IMAGE_TILE];
+    for (size_t i = 0; i < count; i += IMAGE_TILE) {
+        size_t n = count - i < IMAGE_TILE ? count - i : IMAGE_TILE;
+        image_denormalize(image->planes[channel] + i, n, tile);
+        for (size_t k = 0; k < n; k++) {
+            bytes[(i + k) * num_chan + channel] = tile[k];
+        }
+    }
+}
+
+// Y = 0.299 R + 0.587 G + 0.114 B in 14-bit fixed point, small enough for pmaddwd
+#define IMAGE_LUMA_BITS 14
+#define IMAGE_LUMA_R 4899
+#define IMAGE_LUMA_G 9617
+#define IMAGE_LUMA_B 1868
+
+static void image__luma_tile(uint8_t tiles[IMAGE_MAX_CHANNELS][IMAGE_TILE], size_t count, int16_t *luma) {
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i rg_weights = _mm_set1_epi32(IMAGE_LUMA_G << 16 | IMAGE_LUMA_R);
+    const __m128i b_weights = _mm_set1_epi32((1 << (IMAGE_LUMA_BITS - 1)) << 16 | IMAGE_LUMA_B);
+    const __m128i one = _mm_set1_epi16(1);
+    const __m128i center = _mm_set1_epi16(128);
+    for (; i + 16 <= count; i += 16) {
+        __m128i r = _mm_loadu_si128((const __m128i *)(tiles[0] + i));
+        __m128i g = _mm_loadu_si128((const __m128i *)(tiles[1] + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(tiles[2] + i));
+        for (size_t half = 0; half < 2; half++) {
+            __m128i r16 = half == 0 ? _mm_unpacklo_epi8(r, zero) : _mm_unpackhi_epi8(r, zero);
+            __m128i g16 = half == 0 ? _mm_unpacklo_epi8(g, zero) : _mm_unpackhi_epi8(g, zero);
+            __m128i b16 = half == 0 ? _mm_unpacklo_epi8(b, zero) : _mm_unpackhi_epi8(b, zero);
+            // (r, g) and (b, 1) pairs against (wr, wg) and (wb, rounding)
+            __m128i lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(r16, g16), rg_weights),
+                                       _mm_madd_epi16(_mm_unpacklo_epi16(b16, one), b_weights));
+            __m128i hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(r16, g16), rg_weights),
+                                       _mm_madd_epi16(_mm_unpackhi_epi16(b16, one), b_weights));
+            __m128i y = _mm_packs_epi32(_mm_srai_epi32(lo, IMAGE_LUMA_BITS), _mm_srai_epi32(hi, IMAGE_LUMA_BITS));
+            _mm_storeu_si128((__m128i *)(luma + i + 8 * half), _mm_sub_epi16(y, center));
+        }
+    }
+#endif
+
+    for (; i < count; i++) {
+        int y = IMAGE_LUMA_R * tiles[0][i] + IMAGE_LUMA_G * tiles[1][i] + IMAGE_LUMA_B * tiles[2][i];
+        luma[i] = (int16_t)(((y + (1 << (IMAGE_LUMA_BITS - 1))) >> IMAGE_LUMA_BITS) - 128);
+    }
+}
+
+void image_to_luma(const uint8_t *bytes, size_t count, size_t num_chan, int16_t *luma) {
+    uint8_t tiles[IMAGE_MAX_CHANNELS][IMAGE_TILE];
+    for (size_t i = 0; i < count; i += IMAGE_TILE) {
+        size_t n = count - i < IMAGE_TILE ? count - i : IMAGE_TILE;
+        image__deinterleave(bytes + i * num_chan, n, num_chan, tiles);
+        image__luma_tile(tiles, n, luma + i);
+    }
+}
+
+void image_set_luma(uint8_t *bytes, size_t count, size_t num_chan, const int16_t *luma) {
+    uint8_t tiles[IMAGE_MAX_CHANNELS][IMAGE_TILE];
+    int16_t delta[IMAGE_TILE];
+    for (size_t i = 0; i < count; i += IMAGE_TILE) {
+        size_t n = count - i < IMAGE_TILE ? count - i : IMAGE_TILE;
+        image__deinterleave(bytes + i * num_chan, n, num_chan, tiles);
+        image__luma_tile(tiles, n, delta);
+        for (size_t k = 0; k < n; k++) {
+            delta[k] = luma[i + k] - delta[k];
+        }
+
+        for (size_t c = 0; c < 3; c++) {
+            size_t k = 0;
+#if defined(__SSE2__)
+            const __m128i zero = _mm_setzero_si128();
+            for (; k + 16 <= n; k += 16) {
+                __m128i v = _mm_loadu_si128((const __m128i *)(tiles[c] + k));
+                __m128i lo = _mm_adds_epi16(_mm_unpacklo_epi8(v, zero), _mm_loadu_si128((const __m128i *)(delta + k)));
+                __m128i hi = _mm_adds_epi16(_mm_unpackhi_epi8(v, zero), _mm_loadu_si128((const __m128i *)(delta + k + 8)));
+                _mm_storeu_si128((__m128i *)(tiles[c] + k), _mm_packus_epi16(lo, hi));
+            }
+#endif
+            for (; k < n; k++) {
+                int v = tiles[c][k] + delta[k];
+                tiles[c][k] = v < 0 ? 0 : v > 255 ? 255 : (uint8_t)v;
+            }
+        }
+        image__interleave(tiles, n, num_chan, bytes + i * num_chan);
+    }
+}
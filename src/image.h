@@ -0,0 +1,50 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    IMAGE_OK = 0,
+    IMAGE_ERR = 1,
+} Image_Result;
+
+#define IMAGE_MAX_CHANNELS 4
+#define IMAGE_ALIGNMENT 32
+
+// Planar copy of an interleaved 8-bit image, one [0, 1] double plane per
+// channel. Every plane is IMAGE_ALIGNMENT aligned.
+typedef struct {
+    double *planes[IMAGE_MAX_CHANNELS];
+    size_t width;
+    size_t height;
+    size_t num_chan;
+} Image_Planes;
+
+Image_Result image_planes_alloc(Image_Planes *image, size_t width, size_t height, size_t num_chan);
+void image_planes_free(Image_Planes *image);
+
+// stbi interleaved bytes -> normalized planes (x / 255.0)
+void image_planes_from_bytes(Image_Planes *image, const uint8_t *bytes);
+// normalized planes -> stbi interleaved bytes (x * 255.0, clamped to [0, 255] and truncated)
+void image_planes_to_bytes(const Image_Planes *image, uint8_t *bytes);
+// Same as image_planes_to_bytes for a single channel, the others are left as is
+void image_planes_channel_to_bytes(const Image_Planes *image, size_t channel, uint8_t *bytes);
+
+// Contiguous helpers used by the kernels above, exposed for single plane users
+void image_normalize(const uint8_t *bytes, size_t count, double *x);
+void image_denormalize(const double *x, size_t count, uint8_t *bytes);
+
+// bytes -> JPEG-style level shifted samples (x - 128) and back, saturating
+void image_to_samples(const uint8_t *bytes, size_t count, int16_t *samples);
+void image_from_samples(const int16_t *samples, size_t count, uint8_t *bytes);
+
+// Level shifted JPEG (BT.601 full range) luma of `count` pixels with num_chan >= 3
+// interleaved channels, RGB first. The weights sum to one in fixed point, so
+// adding d to R, G and B adds exactly d to the luma.
+void image_to_luma(const uint8_t *bytes, size_t count, size_t num_chan, int16_t *luma);
+// Moves R, G and B of every pixel by the same amount so that its luma becomes
+// the given one, which leaves Cb and Cr as they were (up to saturation)
+void image_set_luma(uint8_t *bytes, size_t count, size_t num_chan, const int16_t *luma);
+
+#endif // IMAGE_H
@@ -0,0 +1,726 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "jpeg.h"
+
+static const char *jpeg__g_failure_reason;
+
+#define JPEG_MAX_TABLES 4
+// Codes up to this many bits are decoded with a single table lookup
+#define JPEG_LOOKUP_BITS 9
+// Baseline limit on the blocks of one MCU in an interleaved scan
+#define JPEG_MAX_BLOCKS_IN_MCU 10
+
+#define JPEG_MARKER_SOF0 0xC0
+#define JPEG_MARKER_SOF1 0xC1
+#define JPEG_MARKER_DHT 0xC4
+#define JPEG_MARKER_RST0 0xD0
+#define JPEG_MARKER_RST7 0xD7
+#define JPEG_MARKER_SOI 0xD8
+#define JPEG_MARKER_EOI 0xD9
+#define JPEG_MARKER_SOS 0xDA
+#define JPEG_MARKER_DRI 0xDD
+
+// Position in the block of the k-th coefficient in zig-zag order
+static const uint8_t JPEG_NATURAL_ORDER[JPEG_BLOCK_COEFFS] = {
+    0,  1,  8,  16, 9,  2,  3,  10, 17, 24, 32, 25, 18, 11, 4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6,  7,  14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+// Annex K tables, the ones stbi_write_jpg uses as well
+static const uint8_t JPEG_STD_DC_LUMINANCE_BITS[16] = {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+static const uint8_t JPEG_STD_DC_LUMINANCE_VALUES[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+static const uint8_t JPEG_STD_AC_LUMINANCE_BITS[16] = {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d};
+static const uint8_t JPEG_STD_AC_LUMINANCE_VALUES[] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07, 0x22, 0x71, 0x14,
+    0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72, 0x82, 0x09,
+    0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a,
+    0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65,
+    0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88,
+    0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9,
+    0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca,
+    0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea,
+    0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa,
+};
+static const uint8_t JPEG_STD_DC_CHROMINANCE_BITS[16] = {0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0};
+static const uint8_t JPEG_STD_DC_CHROMINANCE_VALUES[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+static const uint8_t JPEG_STD_AC_CHROMINANCE_BITS[16] = {0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77};
+static const uint8_t JPEG_STD_AC_CHROMINANCE_VALUES[] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71, 0x13, 0x22, 0x32,
+    0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0, 0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16,
+    0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39,
+    0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64,
+    0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86,
+    0x87, 0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8,
+    0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9,
+    0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa,
+};
+
+typedef struct {
+    int present;
+    uint8_t values[256];
+    int32_t maxcode[17]; // largest code of each length, -1 when there is none
+    int32_t mincode[17];
+    int32_t valptr[17];  // index in values of the smallest code of each length
+    uint16_t lookup[1 << JPEG_LOOKUP_BITS]; // (length << 8) | value, 0 for longer codes
+} Jpeg_Huffman_Decoder;
+
+typedef struct {
+    uint16_t code[256];
+    uint8_t size[256];
+} Jpeg_Huffman_Encoder;
+
+// Entropy coded data reader, undoes the 0xFF00 byte stuffing and feeds zeros
+// once it reaches a marker without consuming it
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+    uint64_t acc;
+    int count;
+} Jpeg_Reader;
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+    uint32_t acc;
+    int count;
+    int failed;
+} Jpeg_Writer;
+
+static uint16_t jpeg__u16(const uint8_t *p) {
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static Jpeg_Result jpeg__build_decoder(Jpeg_Huffman_Decoder *d, const uint8_t bits[16], const uint8_t *values) {
+    memset(d, 0, sizeof(Jpeg_Huffman_Decoder));
+
+    int32_t code = 0;
+    int32_t k = 0;
+    for (int len = 1; len <= 16; len++) {
+        d->valptr[len] = k;
+        d->mincode[len] = code;
+        for (int i = 0; i < bits[len - 1]; i++, k++, code++) {
+            // The all ones code of each length is reserved, so a table that
+            // reaches it has too many codes and would overrun lookup
+            if (code >= (1 << len) - 1) {
+                jpeg__g_failure_reason = "Invalid Huffman table";
+                return JPEG_ERR;
+            }
+            d->values[k] = values[k];
+            if (len <= JPEG_LOOKUP_BITS) {
+                int shift = JPEG_LOOKUP_BITS - len;
+                for (int32_t fill = 0; fill < (1 << shift); fill++) {
+                    d->lookup[(code << shift) | fill] = (uint16_t)(len << 8 | values[k]);
+                }
+            }
+        }
+        d->maxcode[len] = bits[len - 1] > 0 ? code - 1 : -1;
+        code <<= 1;
+    }
+
+    d->present = 1;
+    return JPEG_OK;
+}
+
+static void jpeg__build_encoder(Jpeg_Huffman_Encoder *e, const uint8_t bits[16], const uint8_t *values) {
+    memset(e, 0, sizeof(Jpeg_Huffman_Encoder));
+
+    uint16_t code = 0;
+    size_t k = 0;
+    for (int len = 1; len <= 16; len++) {
+        for (int i = 0; i < bits[len - 1]; i++, k++, code++) {
+            e->code[values[k]] = code;
+            e->size[values[k]] = (uint8_t)len;
+        }
+        code <<= 1;
+    }
+}
+
+static uint8_t jpeg__next_byte(Jpeg_Reader *r) {
+    if (r->pos >= r->size) {
+        return 0;
+    }
+    uint8_t byte = r->data[r->pos];
+    if (byte == 0xFF) {
+        if (r->pos + 1 < r->size && r->data[r->pos + 1] == 0x00) {
+            r->pos += 2;
+            return 0xFF;
+        }
+        return 0;
+    }
+    r->pos++;
+    return byte;
+}
+
+static void jpeg__fill(Jpeg_Reader *r) {
+    while (r->count <= 56) {
+        r->acc = (r->acc << 8) | jpeg__next_byte(r);
+        r->count += 8;
+    }
+}
+
+static int32_t jpeg__get_bits(Jpeg_Reader *r, int n) {
+    if (n == 0) {
+        return 0;
+    }
+    jpeg__fill(r);
+    r->count -= n;
+    return (int32_t)((r->acc >> r->count) & ((1u << n) - 1));
+}
+
+// Value of the n-bit magnitude category: the low half of the range is negative
+static int32_t jpeg__extend(int32_t v, int n) {
+    return n > 0 && v < (1 << (n - 1)) ? v - (1 << n) + 1 : v;
+}
+
+static int jpeg__decode(Jpeg_Reader *r, const Jpeg_Huffman_Decoder *d) {
+    jpeg__fill(r);
+
+    uint32_t peek = (uint32_t)(r->acc >> (r->count - JPEG_LOOKUP_BITS)) & ((1u << JPEG_LOOKUP_BITS) - 1);
+    uint16_t entry = d->lookup[peek];
+    if (entry != 0) {
+        r->count -= entry >> 8;
+        return entry & 0xFF;
+    }
+
+    for (int len = JPEG_LOOKUP_BITS + 1; len <= 16; len++) {
+        int32_t code = (int32_t)((r->acc >> (r->count - len)) & ((1u << len) - 1));
+        if (code <= d->maxcode[len]) {
+            r->count -= len;
+            return d->values[d->valptr[len] + code - d->mincode[len]];
+        }
+    }
+    return -1;
+}
+
+static Jpeg_Result jpeg__decode_block(Jpeg_Reader *r, const Jpeg_Huffman_Decoder *dc, const Jpeg_Huffman_Decoder *ac,
+                                      int32_t *pred, int16_t *block) {
+    memset(block, 0, sizeof(int16_t) * JPEG_BLOCK_COEFFS);
+
+    int s = jpeg__decode(r, dc);
+    if (s < 0 || s > 11) {
+        jpeg__g_failure_reason = "Corrupt JPEG data";
+        return JPEG_ERR;
+    }
+    *pred += jpeg__extend(jpeg__get_bits(r, s), s);
+    block[0] = (int16_t)*pred;
+
+    for (int k = 1; k < JPEG_BLOCK_COEFFS; k++) {
+        int rs = jpeg__decode(r, ac);
+        if (rs < 0) {
+            jpeg__g_failure_reason = "Corrupt JPEG data";
+            return JPEG_ERR;
+        }
+        int run = rs >> 4;
+        s = rs & 0x0F;
+        if (s == 0) {
+            if (run != 15) {
+                break;
+            }
+            k += 15;
+            continue;
+        }
+        k += run;
+        if (k >= JPEG_BLOCK_COEFFS) {
+            jpeg__g_failure_reason = "Corrupt JPEG data";
+            return JPEG_ERR;
+        }
+        block[JPEG_NATURAL_ORDER[k]] = (int16_t)jpeg__extend(jpeg__get_bits(r, s), s);
+    }
+
+    return JPEG_OK;
+}
+
+// Skips to the RSTn marker closing a restart interval and resets the reader
+static void jpeg__restart(Jpeg_Reader *r) {
+    r->acc = 0;
+    r->count = 0;
+    while (r->pos + 1 < r->size) {
+        if (r->data[r->pos] == 0xFF && r->data[r->pos + 1] >= JPEG_MARKER_RST0 && r->data[r->pos + 1] <= JPEG_MARKER_RST7) {
+            r->pos += 2;
+            return;
+        }
+        r->pos++;
+    }
+}
+
+static Jpeg_Result jpeg__parse_sof(Jpeg_Coefficients *jpeg, const uint8_t *p, size_t length) {
+    if (length < 6 || p[0] != 8) {
+        jpeg__g_failure_reason = "Only 8-bit JPEGs are supported";
+        return JPEG_ERR;
+    }
+    jpeg->height = jpeg__u16(p + 1);
+    jpeg->width = jpeg__u16(p + 3);
+    jpeg->num_comp = p[5];
+    if (jpeg->width == 0 || jpeg->height == 0) {
+        jpeg__g_failure_reason = "JPEGs with a DNL marker are not supported";
+        return JPEG_ERR;
+    }
+    if (jpeg->num_comp == 0 || jpeg->num_comp > JPEG_MAX_COMPONENTS || length < 6 + 3 * jpeg->num_comp) {
+        jpeg__g_failure_reason = "Invalid JPEG frame header";
+        return JPEG_ERR;
+    }
+
+    size_t h_max = 1, v_max = 1;
+    for (size_t c = 0; c < jpeg->num_comp; c++) {
+        Jpeg_Component *comp = &jpeg->comps[c];
+        comp->id = p[6 + 3 * c];
+        comp->h = p[7 + 3 * c] >> 4;
+        comp->v = p[7 + 3 * c] & 0x0F;
+        if (comp->h < 1 || comp->h > 4 || comp->v < 1 || comp->v > 4) {
+            jpeg__g_failure_reason = "Invalid JPEG sampling factors";
+            return JPEG_ERR;
+        }
+        h_max = comp->h > h_max ? comp->h : h_max;
+        v_max = comp->v > v_max ? comp->v : v_max;
+    }
+
+    size_t mcus_w = (jpeg->width + 8 * h_max - 1) / (8 * h_max);
+    size_t mcus_h = (jpeg->height + 8 * v_max - 1) / (8 * v_max);
+    for (size_t c = 0; c < jpeg->num_comp; c++) {
+        Jpeg_Component *comp = &jpeg->comps[c];
+        comp->blocks_w = ((jpeg->width * comp->h + h_max - 1) / h_max + 7) / 8;
+        comp->blocks_h = ((jpeg->height * comp->v + v_max - 1) / v_max + 7) / 8;
+        comp->stride_w = mcus_w * comp->h;
+        comp->stride_h = mcus_h * comp->v;
+        comp->coeffs = calloc(comp->stride_w * comp->stride_h * JPEG_BLOCK_COEFFS, sizeof(int16_t));
+        if (comp->coeffs == NULL) {
+            jpeg__g_failure_reason = "Out of memory";
+            return JPEG_ERR;
+        }
+    }
+
+    return JPEG_OK;
+}
+
+static Jpeg_Result jpeg__parse_dht(Jpeg_Huffman_Decoder tables[2][JPEG_MAX_TABLES], const uint8_t *p, size_t length) {
+    while (length > 0) {
+        if (length < 17) {
+            jpeg__g_failure_reason = "Invalid Huffman table";
+            return JPEG_ERR;
+        }
+        size_t table_class = p[0] >> 4;
+        size_t id = p[0] & 0x0F;
+        size_t count = 0;
+        for (size_t i = 0; i < 16; i++) {
+            count += p[1 + i];
+        }
+        if (table_class > 1 || id >= JPEG_MAX_TABLES || count > 256 || length < 17 + count) {
+            jpeg__g_failure_reason = "Invalid Huffman table";
+            return JPEG_ERR;
+        }
+        if (jpeg__build_decoder(&tables[table_class][id], p + 1, p + 17) != JPEG_OK) {
+            return JPEG_ERR;
+        }
+        p += 17 + count;
+        length -= 17 + count;
+    }
+    return JPEG_OK;
+}
+
+static Jpeg_Result jpeg__decode_scan(Jpeg_Coefficients *jpeg, Jpeg_Huffman_Decoder tables[2][JPEG_MAX_TABLES],
+                                     size_t restart_interval, const uint8_t *p, size_t length, Jpeg_Reader *r) {
+    if (jpeg->num_comp == 0) {
+        jpeg__g_failure_reason = "JPEG scan before the frame header";
+        return JPEG_ERR;
+    }
+
+    size_t num_scan = length > 0 ? p[0] : 0;
+    if (num_scan == 0 || num_scan > jpeg->num_comp || length < 4 + 2 * num_scan) {
+        jpeg__g_failure_reason = "Invalid JPEG scan header";
+        return JPEG_ERR;
+    }
+    const uint8_t *spectral = p + 1 + 2 * num_scan;
+    if (spectral[0] != 0 || spectral[1] != 63 || spectral[2] != 0) {
+        jpeg__g_failure_reason = "Only baseline JPEGs are supported";
+        return JPEG_ERR;
+    }
+
+    size_t comps[JPEG_MAX_COMPONENTS];
+    const Jpeg_Huffman_Decoder *dc[JPEG_MAX_COMPONENTS];
+    const Jpeg_Huffman_Decoder *ac[JPEG_MAX_COMPONENTS];
+    int32_t pred[JPEG_MAX_COMPONENTS] = {0};
+    size_t mcu_blocks = 0;
+    for (size_t s = 0; s < num_scan; s++) {
+        uint8_t id = p[1 + 2 * s];
+        size_t td = p[2 + 2 * s] >> 4;
+        size_t ta = p[2 + 2 * s] & 0x0F;
+
+        comps[s] = jpeg->num_comp;
+        for (size_t c = 0; c < jpeg->num_comp; c++) {
+            if (jpeg->comps[c].id == id) {
+                comps[s] = c;
+            }
+        }
+        if (comps[s] == jpeg->num_comp || td >= JPEG_MAX_TABLES || ta >= JPEG_MAX_TABLES ||
+            !tables[0][td].present || !tables[1][ta].present) {
+            jpeg__g_failure_reason = "Invalid JPEG scan header";
+            return JPEG_ERR;
+        }
+        dc[s] = &tables[0][td];
+        ac[s] = &tables[1][ta];
+        mcu_blocks += jpeg->comps[comps[s]].h * jpeg->comps[comps[s]].v;
+    }
+    if (num_scan > 1 && mcu_blocks > JPEG_MAX_BLOCKS_IN_MCU) {
+        jpeg__g_failure_reason = "Invalid JPEG scan header";
+        return JPEG_ERR;
+    }
+
+    r->pos = (size_t)(p + length - r->data);
+    r->acc = 0;
+    r->count = 0;
+
+    // A single component scan is not interleaved: its MCU is one block and it
+    // only covers the blocks of the component itself
+    const Jpeg_Component *first = &jpeg->comps[comps[0]];
+    size_t mcus_w = num_scan == 1 ? first->blocks_w : first->stride_w / first->h;
+    size_t mcus_h = num_scan == 1 ? first->blocks_h : first->stride_h / first->v;
+    size_t mcus = mcus_w * mcus_h;
+    for (size_t m = 0; m < mcus; m++) {
+        if (restart_interval > 0 && m > 0 && m % restart_interval == 0) {
+            jpeg__restart(r);
+            memset(pred, 0, sizeof(pred));
+        }
+
+        size_t mx = m % mcus_w;
+        size_t my = m / mcus_w;
+        for (size_t s = 0; s < num_scan; s++) {
+            const Jpeg_Component *comp = &jpeg->comps[comps[s]];
+            size_t h = num_scan == 1 ? 1 : comp->h;
+            size_t v = num_scan == 1 ? 1 : comp->v;
+            for (size_t y = 0; y < v; y++) {
+                for (size_t x = 0; x < h; x++) {
+                    int16_t *block = jpeg_block(jpeg, comps[s], mx * h + x, my * v + y);
+                    if (jpeg__decode_block(r, dc[s], ac[s], &pred[s], block) != JPEG_OK) {
+                        return JPEG_ERR;
+                    }
+                }
+            }
+        }
+    }
+
+    // Leave the reader on the marker following the entropy coded data
+    while (r->pos + 1 < r->size) {
+        uint8_t next = r->data[r->pos + 1];
+        if (r->data[r->pos] == 0xFF && next != 0x00 && (next < JPEG_MARKER_RST0 || next > JPEG_MARKER_RST7)) {
+            break;
+        }
+        r->pos++;
+    }
+    return JPEG_OK;
+}
+
+static Jpeg_Result jpeg__keep_segment(Jpeg_Coefficients *jpeg, const uint8_t *segment, size_t size) {
+    uint8_t *segments = realloc(jpeg->segments, jpeg->segments_size + size);
+    if (segments == NULL) {
+        jpeg__g_failure_reason = "Out of memory";
+        return JPEG_ERR;
+    }
+    memcpy(segments + jpeg->segments_size, segment, size);
+    jpeg->segments = segments;
+    jpeg->segments_size += size;
+    return JPEG_OK;
+}
+
+int jpeg_is_jpeg(const uint8_t *data, size_t size) {
+    return size >= 3 && data[0] == 0xFF && data[1] == JPEG_MARKER_SOI && data[2] == 0xFF;
+}
+
+Jpeg_Result jpeg_read_coefficients(const uint8_t *data, size_t size, Jpeg_Coefficients *jpeg) {
+    memset(jpeg, 0, sizeof(Jpeg_Coefficients));
+    if (!jpeg_is_jpeg(data, size)) {
+        jpeg__g_failure_reason = "Not a JPEG file";
+        return JPEG_ERR;
+    }
+
+    // Large, keep it off the stack
+    Jpeg_Huffman_Decoder (*tables)[JPEG_MAX_TABLES] = calloc(2, sizeof(*tables));
+    if (tables == NULL) {
+        jpeg__g_failure_reason = "Out of memory";
+        return JPEG_ERR;
+    }
+
+    Jpeg_Result result = JPEG_ERR;
+    Jpeg_Reader reader = {.data = data, .size = size, .pos = 2};
+    size_t restart_interval = 0;
+    int seen_frame = 0, seen_scan = 0;
+    for (;;) {
+        // Markers may be preceded by any number of 0xFF fill bytes
+        while (reader.pos < size && data[reader.pos] == 0xFF && reader.pos + 1 < size && data[reader.pos + 1] == 0xFF) {
+            reader.pos++;
+        }
+        if (reader.pos + 1 >= size || data[reader.pos] != 0xFF) {
+            jpeg__g_failure_reason = "Truncated JPEG file";
+            goto defer;
+        }
+
+        size_t start = reader.pos;
+        uint8_t marker = data[reader.pos + 1];
+        if (marker == JPEG_MARKER_EOI) {
+            break;
+        }
+        if (reader.pos + 4 > size) {
+            jpeg__g_failure_reason = "Truncated JPEG file";
+            goto defer;
+        }
+        size_t length = jpeg__u16(data + reader.pos + 2);
+        if (length < 2 || reader.pos + 2 + length > size) {
+            jpeg__g_failure_reason = "Truncated JPEG file";
+            goto defer;
+        }
+        const uint8_t *payload = data + reader.pos + 4;
+        length -= 2;
+        reader.pos += 4 + length;
+
+        if (marker == JPEG_MARKER_SOF0 || marker == JPEG_MARKER_SOF1) {
+            if (seen_frame) {
+                jpeg__g_failure_reason = "Invalid JPEG frame header";
+                goto defer;
+            }
+            seen_frame = 1;
+            if (jpeg__parse_sof(jpeg, payload, length) != JPEG_OK) {
+                goto defer;
+            }
+        } else if (marker >= 0xC2 && marker <= 0xCF && marker != JPEG_MARKER_DHT && marker != 0xC8 && marker != 0xCC) {
+            jpeg__g_failure_reason = "Only baseline JPEGs are supported";
+            goto defer;
+        } else if (marker == JPEG_MARKER_DHT) {
+            if (jpeg__parse_dht(tables, payload, length) != JPEG_OK) {
+                goto defer;
+            }
+            continue;
+        } else if (marker == JPEG_MARKER_DRI) {
+            if (length < 2) {
+                jpeg__g_failure_reason = "Invalid JPEG restart interval";
+                goto defer;
+            }
+            restart_interval = jpeg__u16(payload);
+            continue;
+        } else if (marker == JPEG_MARKER_SOS) {
+            seen_scan = 1;
+            if (jpeg__decode_scan(jpeg, tables, restart_interval, payload, length, &reader) != JPEG_OK) {
+                goto defer;
+            }
+            continue;
+        }
+
+        if (!seen_scan && jpeg__keep_segment(jpeg, data + start, reader.pos - start) != JPEG_OK) {
+            goto defer;
+        }
+    }
+
+    if (!seen_scan) {
+        jpeg__g_failure_reason = "JPEG file without image data";
+        goto defer;
+    }
+    result = JPEG_OK;
+
+defer:
+    free(tables);
+    if (result != JPEG_OK) {
+        jpeg_coefficients_free(jpeg);
+    }
+    return result;
+}
+
+static void jpeg__put_byte(Jpeg_Writer *w, uint8_t byte) {
+    if (w->size == w->capacity) {
+        size_t capacity = w->capacity > 0 ? 2 * w->capacity : 4096;
+        uint8_t *data = realloc(w->data, capacity);
+        if (data == NULL) {
+            w->failed = 1;
+            return;
+        }
+        w->data = data;
+        w->capacity = capacity;
+    }
+    w->data[w->size++] = byte;
+}
+
+static void jpeg__put_bytes(Jpeg_Writer *w, const uint8_t *bytes, size_t count) {
+    for (size_t i = 0; i < count && !w->failed; i++) {
+        jpeg__put_byte(w, bytes[i]);
+    }
+}
+
+static void jpeg__put_u16(Jpeg_Writer *w, size_t value) {
+    jpeg__put_byte(w, (uint8_t)(value >> 8));
+    jpeg__put_byte(w, (uint8_t)value);
+}
+
+static void jpeg__put_bits(Jpeg_Writer *w, uint32_t bits, int n) {
+    w->acc = (w->acc << n) | (bits & ((1u << n) - 1));
+    w->count += n;
+    while (w->count >= 8) {
+        w->count -= 8;
+        uint8_t byte = (uint8_t)(w->acc >> w->count);
+        jpeg__put_byte(w, byte);
+        if (byte == 0xFF) {
+            jpeg__put_byte(w, 0x00);
+        }
+    }
+    w->acc &= (1u << w->count) - 1;
+}
+
+// Pads the last byte with ones, as the spec asks
+static void jpeg__flush_bits(Jpeg_Writer *w) {
+    if (w->count > 0) {
+        jpeg__put_bits(w, 0xFF, 8 - w->count);
+    }
+}
+
+static int jpeg__magnitude_bits(int32_t value) {
+    uint32_t magnitude = value < 0 ? (uint32_t)-value : (uint32_t)value;
+    int n = 0;
+    while (magnitude > 0) {
+        magnitude >>= 1;
+        n++;
+    }
+    return n;
+}
+
+static void jpeg__encode_block(Jpeg_Writer *w, const Jpeg_Huffman_Encoder *dc, const Jpeg_Huffman_Encoder *ac,
+                               int32_t *pred, const int16_t *block) {
+    int32_t diff = block[0] - *pred;
+    *pred = block[0];
+    int n = jpeg__magnitude_bits(diff);
+    jpeg__put_bits(w, dc->code[n], dc->size[n]);
+    if (n > 0) {
+        jpeg__put_bits(w, (uint32_t)(diff < 0 ? diff - 1 : diff), n);
+    }
+
+    int run = 0;
+    for (int k = 1; k < JPEG_BLOCK_COEFFS; k++) {
+        int32_t value = block[JPEG_NATURAL_ORDER[k]];
+        if (value == 0) {
+            run++;
+            continue;
+        }
+        for (; run > 15; run -= 16) {
+            jpeg__put_bits(w, ac->code[0xF0], ac->size[0xF0]);
+        }
+        n = jpeg__magnitude_bits(value);
+        uint8_t symbol = (uint8_t)(run << 4 | n);
+        jpeg__put_bits(w, ac->code[symbol], ac->size[symbol]);
+        jpeg__put_bits(w, (uint32_t)(value < 0 ? value - 1 : value), n);
+        run = 0;
+    }
+    if (run > 0) {
+        jpeg__put_bits(w, ac->code[0x00], ac->size[0x00]);
+    }
+}
+
+static void jpeg__put_table(Jpeg_Writer *w, uint8_t id, const uint8_t bits[16], const uint8_t *values) {
+    size_t count = 0;
+    for (size_t i = 0; i < 16; i++) {
+        count += bits[i];
+    }
+    jpeg__put_byte(w, id);
+    jpeg__put_bytes(w, bits, 16);
+    jpeg__put_bytes(w, values, count);
+}
+
+// Writes the scan over comps[0..num_scan) with table set 0 for the first
+// component (luma) and 1 for the others
+static void jpeg__encode_scan(Jpeg_Writer *w, const Jpeg_Coefficients *jpeg, const size_t *comps, size_t num_scan,
+                              const Jpeg_Huffman_Encoder *encoders) {
+    jpeg__put_byte(w, 0xFF);
+    jpeg__put_byte(w, JPEG_MARKER_SOS);
+    jpeg__put_u16(w, 6 + 2 * num_scan);
+    jpeg__put_byte(w, (uint8_t)num_scan);
+    for (size_t s = 0; s < num_scan; s++) {
+        jpeg__put_byte(w, jpeg->comps[comps[s]].id);
+        jpeg__put_byte(w, comps[s] == 0 ? 0x00 : 0x11);
+    }
+    jpeg__put_byte(w, 0);
+    jpeg__put_byte(w, 63);
+    jpeg__put_byte(w, 0);
+
+    const Jpeg_Component *first = &jpeg->comps[comps[0]];
+    size_t mcus_w = num_scan == 1 ? first->blocks_w : first->stride_w / first->h;
+    size_t mcus_h = num_scan == 1 ? first->blocks_h : first->stride_h / first->v;
+    int32_t pred[JPEG_MAX_COMPONENTS] = {0};
+    for (size_t my = 0; my < mcus_h && !w->failed; my++) {
+        for (size_t mx = 0; mx < mcus_w; mx++) {
+            for (size_t s = 0; s < num_scan; s++) {
+                const Jpeg_Component *comp = &jpeg->comps[comps[s]];
+                const Jpeg_Huffman_Encoder *dc = &encoders[comps[s] == 0 ? 0 : 2];
+                const Jpeg_Huffman_Encoder *ac = &encoders[comps[s] == 0 ? 1 : 3];
+                size_t h = num_scan == 1 ? 1 : comp->h;
+                size_t v = num_scan == 1 ? 1 : comp->v;
+                for (size_t y = 0; y < v; y++) {
+                    for (size_t x = 0; x < h; x++) {
+                        jpeg__encode_block(w, dc, ac, &pred[s], jpeg_block(jpeg, comps[s], mx * h + x, my * v + y));
+                    }
+                }
+            }
+        }
+    }
+    jpeg__flush_bits(w);
+}
+
+Jpeg_Result jpeg_write_coefficients(const Jpeg_Coefficients *jpeg, uint8_t **data, size_t *size) {
+    Jpeg_Huffman_Encoder encoders[4];
+    jpeg__build_encoder(&encoders[0], JPEG_STD_DC_LUMINANCE_BITS, JPEG_STD_DC_LUMINANCE_VALUES);
+    jpeg__build_encoder(&encoders[1], JPEG_STD_AC_LUMINANCE_BITS, JPEG_STD_AC_LUMINANCE_VALUES);
+    jpeg__build_encoder(&encoders[2], JPEG_STD_DC_CHROMINANCE_BITS, JPEG_STD_DC_CHROMINANCE_VALUES);
+    jpeg__build_encoder(&encoders[3], JPEG_STD_AC_CHROMINANCE_BITS, JPEG_STD_AC_CHROMINANCE_VALUES);
+
+    Jpeg_Writer w = {0};
+    jpeg__put_byte(&w, 0xFF);
+    jpeg__put_byte(&w, JPEG_MARKER_SOI);
+    jpeg__put_bytes(&w, jpeg->segments, jpeg->segments_size);
+
+    jpeg__put_byte(&w, 0xFF);
+    jpeg__put_byte(&w, JPEG_MARKER_DHT);
+    jpeg__put_u16(&w, 2 + 4 * 17 + sizeof(JPEG_STD_DC_LUMINANCE_VALUES) + sizeof(JPEG_STD_AC_LUMINANCE_VALUES) +
+                          sizeof(JPEG_STD_DC_CHROMINANCE_VALUES) + sizeof(JPEG_STD_AC_CHROMINANCE_VALUES));
+    jpeg__put_table(&w, 0x00, JPEG_STD_DC_LUMINANCE_BITS, JPEG_STD_DC_LUMINANCE_VALUES);
+    jpeg__put_table(&w, 0x10, JPEG_STD_AC_LUMINANCE_BITS, JPEG_STD_AC_LUMINANCE_VALUES);
+    jpeg__put_table(&w, 0x01, JPEG_STD_DC_CHROMINANCE_BITS, JPEG_STD_DC_CHROMINANCE_VALUES);
+    jpeg__put_table(&w, 0x11, JPEG_STD_AC_CHROMINANCE_BITS, JPEG_STD_AC_CHROMINANCE_VALUES);
+
+    // One interleaved scan when the MCU fits the baseline limit, else one scan per component
+    size_t comps[JPEG_MAX_COMPONENTS];
+    size_t mcu_blocks = 0;
+    for (size_t c = 0; c < jpeg->num_comp; c++) {
+        comps[c] = c;
+        mcu_blocks += jpeg->comps[c].h * jpeg->comps[c].v;
+    }
+    if (jpeg->num_comp == 1 || mcu_blocks <= JPEG_MAX_BLOCKS_IN_MCU) {
+        jpeg__encode_scan(&w, jpeg, comps, jpeg->num_comp, encoders);
+    } else {
+        for (size_t c = 0; c < jpeg->num_comp; c++) {
+            jpeg__encode_scan(&w, jpeg, &comps[c], 1, encoders);
+        }
+    }
+
+    jpeg__put_byte(&w, 0xFF);
+    jpeg__put_byte(&w, JPEG_MARKER_EOI);
+
+    if (w.failed) {
+        free(w.data);
+        jpeg__g_failure_reason = "Out of memory";
+        return JPEG_ERR;
+    }
+    *data = w.data;
+    *size = w.size;
+    return JPEG_OK;
+}
+
+void jpeg_coefficients_free(Jpeg_Coefficients *jpeg) {
+    for (size_t c = 0; c < JPEG_MAX_COMPONENTS; c++) {
+        free(jpeg->comps[c].coeffs);
+        jpeg->comps[c].coeffs = NULL;
+    }
+    free(jpeg->segments);
+    jpeg->segments = NULL;
+    jpeg->segments_size = 0;
+}
+
+const char *jpeg_failure_reason(void) { return jpeg__g_failure_reason; }
@@ -0,0 +1,58 @@
+#ifndef JPEG_H
+#define JPEG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    JPEG_OK = 0,
+    JPEG_ERR = 1,
+} Jpeg_Result;
+
+#define JPEG_MAX_COMPONENTS 4
+#define JPEG_BLOCK_COEFFS 64
+
+// Quantized coefficients of one component, 64 per 8x8 block in natural
+// (row-major) order. blocks_w x blocks_h blocks cover the component, the
+// allocation is padded to whole MCUs (stride_w x stride_h blocks).
+typedef struct {
+    uint8_t id;
+    uint8_t h;
+    uint8_t v;
+    size_t blocks_w;
+    size_t blocks_h;
+    size_t stride_w;
+    size_t stride_h;
+    int16_t *coeffs;
+} Jpeg_Component;
+
+// Entropy decoded baseline (sequential Huffman, 8-bit) JPEG. The marker segments
+// found before the first scan other than DHT and DRI (APPn, COM, DQT, SOF) are
+// kept as is, so the writer emits the same quantization tables and metadata.
+typedef struct {
+    size_t width;
+    size_t height;
+    size_t num_comp;
+    Jpeg_Component comps[JPEG_MAX_COMPONENTS];
+
+    uint8_t *segments;
+    size_t segments_size;
+} Jpeg_Coefficients;
+
+Jpeg_Result jpeg_read_coefficients(const uint8_t *data, size_t size, Jpeg_Coefficients *jpeg);
+// Writes a baseline JPEG with the standard (Annex K) Huffman tables and no
+// restart markers, into a buffer the caller frees
+Jpeg_Result jpeg_write_coefficients(const Jpeg_Coefficients *jpeg, uint8_t **data, size_t *size);
+void jpeg_coefficients_free(Jpeg_Coefficients *jpeg);
+
+static inline int16_t *jpeg_block(const Jpeg_Coefficients *jpeg, size_t comp, size_t bx, size_t by) {
+    const Jpeg_Component *c = &jpeg->comps[comp];
+    return c->coeffs + (by * c->stride_w + bx) * JPEG_BLOCK_COEFFS;
+}
+
+// Whether the buffer starts with a JPEG SOI marker
+int jpeg_is_jpeg(const uint8_t *data, size_t size);
+
+const char *jpeg_failure_reason(void);
+
+#endif // JPEG_H
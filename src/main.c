@@ -1,11 +1,15 @@
 #include <time.h>
 #include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "error.h"
+#include "jpeg.h"
 #include "steg.h"
 #include "stb_image.h"
 #include "stb_image_write.h"
@@ -25,12 +29,177 @@
 #define COMMAND_VERSION "version"
 #define COMMAND_HELP "help"
 
+// Replaces a payload read with aids_io_read by its --crc framed body
+static void command__integrity_wrap(uint8_t **payload, size_t *payload_length) {
+    uint8_t *body = NULL;
+    size_t body_length = 0;
+    if (steg_integrity_wrap(*payload, *payload_length, &body, &body_length) != STEG_OK) {
+        aids_log(AIDS_ERROR, "Error adding the integrity check: %s", steg_failure_reason());
+        exit(EXIT_FAILURE);
+    }
+
+    AIDS_FREE(*payload);
+    *payload = body;
+    *payload_length = body_length;
+}
+
+// Checks and strips the --crc framing of an extracted message in place
+static void command__integrity_unwrap(uint8_t *message, size_t *message_length) {
+    if (steg_integrity_unwrap(message, message_length) != STEG_OK) {
+        aids_log(AIDS_ERROR, "Error showing message from image: %s", steg_failure_reason());
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Payloads hidden with --compress are the original length (8 bytes, little
+// endian) followed by the zlib stream. The length prefix of the method records
+// that they are (STEG_PAYLOAD_COMPRESSED), which is what tells the show
+// commands to inflate them.
+#define COMMAND_DEFLATE_HEADER_SIZE 8
+#define COMMAND_DEFLATE_QUALITY 8
+
+// Defined with the stb_image_write implementation at the end of the file, the
+// header only declares it in its implementation section
+unsigned char *stbi_zlib_compress(unsigned char *data, int data_len, int *out_len, int quality);
+
+// Replaces a payload read with aids_io_read by its --compress body, or keeps
+// it as is when deflate does not make it smaller. Returns whether it did.
+static bool command__deflate(uint8_t **payload, size_t *payload_length) {
+    if (*payload_length > INT_MAX) {
+        aids_log(AIDS_ERROR, "Payload is too large to compress");
+        exit(EXIT_FAILURE);
+    }
+
+    int deflated_length = 0;
+    unsigned char *deflated = stbi_zlib_compress(*payload, (int)*payload_length, &deflated_length, COMMAND_DEFLATE_QUALITY);
+    if (deflated == NULL) {
+        aids_log(AIDS_ERROR, "Error compressing the payload");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t body_length = COMMAND_DEFLATE_HEADER_SIZE + deflated_length;
+    if (body_length >= *payload_length) {
+        aids_log(AIDS_INFO, "The payload does not compress, hiding it as is");
+        free(deflated);
+        return false;
+    }
+
+    uint8_t *body = malloc(body_length);
+    if (body == NULL) {
+        aids_log(AIDS_ERROR, "Memory allocation failed for the compressed payload");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < COMMAND_DEFLATE_HEADER_SIZE; i++) {
+        body[i] = (uint8_t)((uint64_t)*payload_length >> (8 * i));
+    }
+    memcpy(body + COMMAND_DEFLATE_HEADER_SIZE, deflated, deflated_length);
+    free(deflated);
+
+    aids_log(AIDS_INFO, "Payload compressed from %zu to %zu bytes", *payload_length, body_length);
+    AIDS_FREE(*payload);
+    *payload = body;
+    *payload_length = body_length;
+    return true;
+}
+
+// Inflates an extracted message hidden with --compress
+static void command__inflate(uint8_t **message, size_t *message_length) {
+    if (*message_length < COMMAND_DEFLATE_HEADER_SIZE) {
+        aids_log(AIDS_ERROR, "Error inflating the hidden message: the message is truncated");
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t length = 0;
+    for (size_t i = 0; i < COMMAND_DEFLATE_HEADER_SIZE; i++) {
+        length |= (uint64_t)(*message)[i] << (8 * i);
+    }
+    size_t deflated_length = *message_length - COMMAND_DEFLATE_HEADER_SIZE;
+    if (length > INT_MAX || deflated_length > INT_MAX) {
+        aids_log(AIDS_ERROR, "Error inflating the hidden message: invalid length");
+        exit(EXIT_FAILURE);
+    }
+
+    int inflated_length = 0;
+    char *inflated = stbi_zlib_decode_malloc_guesssize_headerflag(
+        (const char *)*message + COMMAND_DEFLATE_HEADER_SIZE, (int)deflated_length, (int)length, &inflated_length, 1);
+    if (inflated == NULL || (uint64_t)inflated_length != length) {
+        aids_log(AIDS_ERROR, "Error inflating the hidden message: %s", inflated == NULL ? stbi_failure_reason() : "length mismatch");
+        exit(EXIT_FAILURE);
+    }
+
+    AIDS_FREE(*message);
+    *message = (uint8_t *)inflated;
+    *message_length = inflated_length;
+}
+
+#define COMMAND_STREAM_BLOCK (64 * 1024)
+
+// Feeds the payload file (stdin if NULL) to an LSB session a block at a time
+static void command__stream_payload(const char *path, Steg_Lsb_Session *session) {
+    FILE *file = path != NULL ? fopen(path, "rb") : stdin;
+    if (file == NULL) {
+        aids_log(AIDS_ERROR, "Error reading payload file: %s", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    uint8_t block[COMMAND_STREAM_BLOCK];
+    size_t count = 0;
+    while ((count = fread(block, 1, sizeof(block), file)) > 0) {
+        if (steg_lsb_write(session, block, count) != STEG_OK) {
+            aids_log(AIDS_ERROR, "Error hiding message in image: %s", steg_failure_reason());
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (ferror(file)) {
+        aids_log(AIDS_ERROR, "Error reading payload file: %s", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    if (file != stdin) {
+        fclose(file);
+    }
+}
+
+// Checks the ECC flags of the LSB commands, returns whether ECC is used
+static bool command__ecc_options(bool hamming, int rs_parity, int interleave, Ecc_Options *options) {
+    if (rs_parity < 0 || rs_parity > RS_MAX_PARITY) {
+        aids_log(AIDS_ERROR, "Reed-Solomon parity must be between 1 and %d", RS_MAX_PARITY);
+        exit(EXIT_FAILURE);
+    }
+    if (hamming && rs_parity > 0) {
+        aids_log(AIDS_ERROR, "--ecc and --rs can not be used together");
+        exit(EXIT_FAILURE);
+    }
+    if (interleave < 1 || interleave > ECC_MAX_DEPTH) {
+        aids_log(AIDS_ERROR, "Interleaving depth must be between 1 and %d", ECC_MAX_DEPTH);
+        exit(EXIT_FAILURE);
+    }
+    if (!hamming && rs_parity == 0) {
+        if (interleave > 1) {
+            aids_log(AIDS_ERROR, "--interleave needs --ecc or --rs");
+            exit(EXIT_FAILURE);
+        }
+        return false;
+    }
+
+    options->code = hamming ? ECC_HAMMING : ECC_RS;
+    options->parity = rs_parity;
+    options->depth = interleave;
+    return true;
+}
+
 typedef struct {
     const char *image_path;  // Path to the image file
     const char *output_path; // Path to save the modified image
     const char *payload_path; // Path to the payload file (default: stdin)
     int compression_level;   // Compression level (default: 1)
     bool ecc;               // Use error correction
+    int rs_parity;          // Reed-Solomon parity bytes per block (0: off)
+    int interleave;         // ECC codewords interleaved per frame (default: 1)
+    bool crc;               // Add a CRC32C integrity check
+    bool compress;          // Deflate the payload
+    bool container;         // Use the chunked container framing
+    int chunk_size;         // Container chunk size in bytes
 } Steg_Hide_Args_Lsb;
 
 static int command_hide_lsb(int argc, char **argv) {
@@ -74,6 +243,48 @@ static int command_hide_lsb(int argc, char **argv) {
                                     .type = ARGUMENT_TYPE_FLAG,
                                     .required = false});
 
+    argparse_add_argument(
+        &parser, (Argparse_Options){.short_name = 'r',
+                                    .long_name = "rs",
+                                    .description = "Use Reed-Solomon with this many parity bytes per 255 byte block, correcting half as many byte errors (default: 0, off)",
+                                    .type = ARGUMENT_TYPE_VALUE,
+                                    .required = false});
+
+    argparse_add_argument(
+        &parser, (Argparse_Options){.short_name = 'd',
+                                    .long_name = "interleave",
+                                    .description = "Number of ECC codewords interleaved together against burst errors (default: 1)",
+                                    .type = ARGUMENT_TYPE_VALUE,
+                                    .required = false});
+
+
+    argparse_add_argument(
+        &parser, (Argparse_Options){.short_name = 'C',
+                                    .long_name = "crc",
+                                    .description = "Add a CRC32C integrity check to the payload (default: false)",
+                                    .type = ARGUMENT_TYPE_FLAG,
+                                    .required = false});
+
+    argparse_add_argument(
+        &parser, (Argparse_Options){.short_name = 'z',
+                                    .long_name = "compress",
+                                    .description = "Deflate the payload before hiding it, show-* inflates it on its own (default: false)",
+                                    .type = ARGUMENT_TYPE_FLAG,
+                                    .required = false});
+
+    argparse_add_argument(
+        &parser, (Argparse_Options){.short_name = 't',
+                                    .long_name = "container",
+                                    .description = "Use the versioned chunked container, show-lsb detects it on its own (default: false)",
+                                    .type = ARGUMENT_TYPE_FLAG,
+                                    .required = false});
+
+    argparse_add_argument(
+        &parser, (Argparse_Options){.short_name = 's',
+                                    .long_name = "chunk-size",
+                                    .description = "Container chunk size in bytes (default: 65536)",
+                                    .type = ARGUMENT_TYPE_VALUE,
+                                    .required = false});
 
     if (argparse_parse(&parser, argc, argv) != ARG_OK) {
         argparse_print_help(&parser);
@@ -86,9 +297,25 @@ static int command_hide_lsb(int argc, char **argv) {
     const char *compression_str = argparse_get_value_or_default(&parser, "compression", "1");
     args.compression_level = atoi(compression_str);
     args.ecc = argparse_get_flag(&parser, "ecc");
+    const char *rs_str = argparse_get_value_or_default(&parser, "rs", "0");
+    args.rs_parity = atoi(rs_str);
+    const char *interleave_str = argparse_get_value_or_default(&parser, "interleave", "1");
+    args.interleave = atoi(interleave_str);
+    args.crc = argparse_get_flag(&parser, "crc");
+    args.compress = argparse_get_flag(&parser, "compress");
+    args.container = argparse_get_flag(&parser, "container");
+    const char *chunk_size_str = argparse_get_value_or_default(&parser, "chunk-size", "65536");
+    args.chunk_size = atoi(chunk_size_str);
 
     argparse_parser_free(&parser);
 
+    Ecc_Options ecc = {0};
+    bool use_ecc = command__ecc_options(args.ecc, args.rs_parity, args.interleave, &ecc);
+    if (args.container && args.chunk_size <= 0) {
+        aids_log(AIDS_ERROR, "Chunk size must be positive");
+        exit(EXIT_FAILURE);
+    }
+
     int width, height, num_chan;
     uint8_t *bytes = stbi_load(args.image_path, &width, &height, &num_chan, 0);
     if (bytes == NULL) {
@@ -97,42 +324,48 @@ static int command_hide_lsb(int argc, char **argv) {
     }
     size_t bytes_length = width * height * num_chan;
 
-    Aids_String_Slice payload_slice = {0};
-    if (aids_io_read(args.payload_path, &payload_slice, "rb") != AIDS_OK) {
-        aids_log(AIDS_ERROR, "Error reading payload file: %s", aids_failure_reason());
-        exit(EXIT_FAILURE);
-    }
-    uint8_t *payload = (uint8_t *)payload_slice.str;
-    size_t payload_length = payload_slice.len;
-
-    uint8_t *payload_with_length = malloc(payload_length + sizeof(size_t));
-    if (payload_with_length == NULL) {
-        aids_log(AIDS_ERROR, "Memory allocation failed for payload with length");
-        exit(EXIT_FAILURE);
-    }
-    memcpy(payload_with_length, &payload_length, sizeof(size_t));
-    memcpy(payload_with_length + sizeof(size_t), payload, payload_length);
-
-    AIDS_FREE(payload);
-    payload = payload_with_length;
-    payload_length += sizeof(size_t); // Include the length prefix
-
-    if (args.ecc) {
-        uint8_t *enc = NULL;
-        size_t enc_length = 0;
-        if (hamming_encode(payload, payload_length, &enc, &enc_length) != ECC_OK) {
-            aids_log(AIDS_ERROR, "Error encoding the message with Hamming Code");
+    // The payload is only read whole when it is transformed before hiding,
+    // otherwise it is streamed into the cover a block at a time
+    uint8_t *payload = NULL;
+    if (args.container || args.compress || args.crc) {
+        Aids_String_Slice payload_slice = {0};
+        if (aids_io_read(args.payload_path, &payload_slice, "rb") != AIDS_OK) {
+            aids_log(AIDS_ERROR, "Error reading payload file: %s", aids_failure_reason());
             exit(EXIT_FAILURE);
         }
+        payload = (uint8_t *)payload_slice.str;
+        size_t payload_length = payload_slice.len;
+        bool compressed = args.compress && command__deflate(&payload, &payload_length);
+        if (args.crc && !args.container) {
+            command__integrity_wrap(&payload, &payload_length);
+        }
 
-        AIDS_FREE(payload);
-        payload = enc;
-        payload_length = enc_length;
-    }
-
-    if (steg_hide_lsb(bytes, bytes_length, (const uint8_t *)payload, payload_length, args.compression_level) != STEG_OK) {
-        aids_log(AIDS_ERROR, "Error hiding message in image: %s", steg_failure_reason());
-        exit(EXIT_FAILURE);
+        Steg_Result result = STEG_OK;
+        if (args.container) {
+            // The container records the framing, and checks and codes every chunk
+            uint8_t container_flags = (compressed ? STEG_CONTAINER_COMPRESSED : 0) |
+                                      (args.crc ? STEG_CONTAINER_CRC : 0) |
+                                      (use_ecc ? STEG_CONTAINER_ECC : 0);
+            result = steg_hide_lsb_container(bytes, bytes_length, payload, payload_length, args.compression_level,
+                                             args.chunk_size, container_flags, &ecc);
+        } else {
+            result = steg_hide_lsb_ecc(bytes, bytes_length, payload, payload_length, args.compression_level,
+                                       use_ecc ? &ecc : NULL, compressed ? STEG_PAYLOAD_COMPRESSED : 0);
+        }
+        if (result != STEG_OK) {
+            aids_log(AIDS_ERROR, "Error hiding message in image: %s", steg_failure_reason());
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        // Length prefix and error correction are applied by the session as it goes
+        Steg_Lsb_Params params = {.compression = args.compression_level, .ecc = use_ecc ? &ecc : NULL};
+        Steg_Lsb_Session *session = NULL;
+        if (steg_lsb_begin(bytes, bytes_length, &params, &session) != STEG_OK) {
+            aids_log(AIDS_ERROR, "Error hiding message in image: %s", steg_failure_reason());
+            exit(EXIT_FAILURE);
+        }
+        command__stream_payload(args.payload_path, session);
+        steg_lsb_end(session);
     }
 
     if (stbi_write_png(args.output_path, width, height, num_chan, bytes,
@@ -160,6 +393,10 @@ typedef struct {
     const char *output_path; // Path to save the modified image (default: stdout)
     int compression_level;  // Compression level (default: 1)
     bool ecc;               // Use error correction
+    int rs_parity;          // Reed-Solomon parity bytes per block (0: off)
+    int interleave;         // ECC codewords interleaved per frame (default: 1)
+    bool crc;               // Check the CRC32C integrity framing
+    int chunk;              // Container chunk to extract (-1: all)
 } Steg_Show_Args_Lsb;
 
 static int command_show_lsb(int argc, char **argv) {
@@ -196,6 +433,34 @@ static int command_show_lsb(int argc, char **argv) {
                                     .type = ARGUMENT_TYPE_FLAG,
                                     .required = false});
 
+    argparse_add_argument(
+        &parser, (Argparse_Options){.short_name = 'r',
+                                    .long_name = "rs",
+                                    .description = "Use Reed-Solomon with this many parity bytes per 255 byte block, correcting half as many byte errors (default: 0, off)",
+                                    .type = ARGUMENT_TYPE_VALUE,
+                                    .required = false});
+
+    argparse_add_argument(
+        &parser, (Argparse_Options){.short_name = 'd',
+                                    .long_name = "interleave",
+                                    .description = "Number of ECC codewords interleaved together against burst errors (default: 1)",
+                                    .type = ARGUMENT_TYPE_VALUE,
+                                    .required = false});
+
+    argparse_add_argument(
+        &parser, (Argparse_Options){.short_name = 'C',
+                                    .long_name = "crc",
+                                    .description = "Check the CRC32C of a payload hidden with --crc, stopping early on covers without one (default: false)",
+                                    .type = ARGUMENT_TYPE_FLAG,
+                                    .required = false});
+
+    argparse_add_argument(
+        &parser, (Argparse_Options){.short_name = 'n',
+                                    .long_name = "chunk",
+                                    .description = "Extract only this chunk of a container (default: all)",
+                                    .type = ARGUMENT_TYPE_VALUE,
+                                    .required = false});
+
     if (argparse_parse(&parser, argc, argv) != ARG_OK) {
         argparse_print_help(&parser);
         exit(EXIT_FAILURE);
@@ -206,9 +471,19 @@ static int command_show_lsb(int argc, char **argv) {
     const char *compression_str = argparse_get_value_or_default(&parser, "compression", "1");
     args.compression_level = atoi(compression_str);
     args.ecc = argparse_get_flag(&parser, "ecc");
+    const char *rs_str = argparse_get_value_or_default(&parser, "rs", "0");
+    args.rs_parity = atoi(rs_str);
+    const char *interleave_str = argparse_get_value_or_default(&parser, "interleave", "1");
+    args.interleave = atoi(interleave_str);
+    args.crc = argparse_get_flag(&parser, "crc");
+    const char *chunk_str = argparse_get_value_or_default(&parser, "chunk", "-1");
+    args.chunk = atoi(chunk_str);
 
     argparse_parser_free(&parser);
 
+    Ecc_Options ecc = {0};
+    bool use_ecc = command__ecc_options(args.ecc, args.rs_parity, args.interleave, &ecc);
+
     int width, height, num_chan;
     uint8_t *bytes = stbi_load(args.image_path, &width, &height, &num_chan, 0);
     if (bytes == NULL) {
@@ -217,29 +492,81 @@ static int command_show_lsb(int argc, char **argv) {
     }
     size_t bytes_length = width * height * num_chan;
 
-    size_t message_length = bytes_length / 8 * args.compression_level;
-    uint8_t *message = malloc(message_length * sizeof(uint8_t));
-    if (steg_show_lsb(bytes, bytes_length, message, message_length, args.compression_level) != STEG_OK) {
-        aids_log(AIDS_ERROR, "Error showing message from image: %s", steg_failure_reason());
-        exit(EXIT_FAILURE);
-    }
-
-    if (args.ecc) {
-        uint8_t *dec = NULL;
-        size_t dec_length = 0;
-        if (hamming_decode(message, message_length, &dec, &dec_length) != ECC_OK) {
-            aids_log(AIDS_ERROR, "Error decoding the message with Hamming Code");
+    size_t message_length = 0;
+    uint8_t *message = NULL;
+    uint8_t flags = 0;
+    Steg_Container container = {0};
+    bool in_container = steg_lsb_has_container(bytes, bytes_length, args.compression_level);
+    if (in_container) {
+        // Containers carry their own framing, ECC options and CRCs
+        if (steg_show_lsb_container(bytes, bytes_length, args.compression_level, &container) != STEG_OK) {
+            aids_log(AIDS_ERROR, "Error showing message from image: %s", steg_failure_reason());
             exit(EXIT_FAILURE);
         }
+        aids_log(AIDS_INFO, "Container version %d: %zu bytes in %zu chunks", container.version,
+                 container.payload_length, container.chunk_count);
 
-        AIDS_FREE(message);
-        message = dec;
-        message_length = dec_length;
+        size_t uncorrected = 0;
+        if (args.chunk >= 0) {
+            if (container.flags & STEG_CONTAINER_COMPRESSED) {
+                aids_log(AIDS_ERROR, "Chunks of a compressed payload can only be extracted all together");
+                exit(EXIT_FAILURE);
+            }
+            message = malloc(container.chunk_size + 1);
+            if (message == NULL) {
+                aids_log(AIDS_ERROR, "Memory allocation failed for the chunk");
+                exit(EXIT_FAILURE);
+            }
+            if (steg_show_lsb_chunk(bytes, bytes_length, args.compression_level, &container, args.chunk,
+                                    message, &message_length, &uncorrected) != STEG_OK) {
+                aids_log(AIDS_ERROR, "Error showing chunk %d from image: %s", args.chunk, steg_failure_reason());
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            if (steg_show_lsb_chunks(bytes, bytes_length, args.compression_level, &container, &message,
+                                     &uncorrected) != STEG_OK) {
+                aids_log(AIDS_ERROR, "Error showing message from image: %s", steg_failure_reason());
+                exit(EXIT_FAILURE);
+            }
+            message_length = container.payload_length;
+        }
+
+        // Chunks that passed their CRC are intact even if some ECC units of
+        // their padding could not be corrected
+        if (uncorrected > 0 && (container.flags & STEG_CONTAINER_CRC)) {
+            aids_log(AIDS_WARNING, "Could not correct %zu of the error correction blocks, the chunk CRCs still match",
+                     uncorrected);
+        } else if (uncorrected > 0) {
+            aids_log(AIDS_ERROR, "Could not correct %zu of the error correction blocks of the message", uncorrected);
+            exit(EXIT_FAILURE);
+        }
+        if (container.flags & STEG_CONTAINER_COMPRESSED) {
+            flags |= STEG_PAYLOAD_COMPRESSED;
+        }
+    } else if (args.chunk >= 0) {
+        aids_log(AIDS_ERROR, "--chunk needs a payload hidden with --container");
+        exit(EXIT_FAILURE);
+    } else {
+        // With --crc the header CRC is checked as soon as it is extracted, so a
+        // cover without a payload is rejected before the rest is
+        size_t uncorrected = 0;
+        if (steg_show_lsb_ecc(bytes, bytes_length, &message, &message_length, args.compression_level,
+                              use_ecc ? &ecc : NULL, args.crc, &flags, &uncorrected) != STEG_OK) {
+            aids_log(AIDS_ERROR, "Error showing message from image: %s", steg_failure_reason());
+            exit(EXIT_FAILURE);
+        }
+        if (uncorrected > 0) {
+            aids_log(AIDS_ERROR, "Could not correct %zu of the error correction blocks of the message", uncorrected);
+            exit(EXIT_FAILURE);
+        }
     }
 
-    message_length = *(size_t *)message;
-    memcpy(message, message + sizeof(size_t), message_length);
-    message = AIDS_REALLOC(message, message_length * sizeof(uint8_t));
+    if (args.crc && !in_container) {
+        command__integrity_unwrap(message, &message_length);
+    }
+    if (flags & STEG_PAYLOAD_COMPRESSED) {
+        command__inflate(&message, &message_length);
+    }
 
     if (message_length > 0) {
         if (args.output_path == NULL) {
@@ -283,8 +610,30 @@ typedef struct {
     const char *image_path;  // Path to the image file
     const char *output_path; // Path to save the modified image
     const char *payload_path; // Path to the payload file (default: stdin)
+    bool blind;              // Embed bytes that can be extracted without the original
+    const char *key;         // Key for the blind mode pattern
+    bool crc;                // Add a CRC32C integrity check (blind mode)
 } Steg_Hide_Args_Fft;
 
+static uint64_t key_from_string(const char *key) {
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (const char *c = key; *c != '\0'; c++) {
+        hash ^= (unsigned char)*c;
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// Without a key every blind mode image uses the same pattern, which anyone
+// can extract, so --blind insists on one
+static void command__check_fft_key(bool blind, const char *key) {
+    if (blind && (key == NULL || *key == '\0')) {
+        aids_log(AIDS_ERROR, "--blind needs a non-empty --key");
+        exit(EXIT_FAILURE);
+    }
+}
+
 static int command_hide_fft(int argc, char **argv) {
     Steg_Hide_Args_Fft args = {0};
 
@@ -310,6 +659,25 @@ static int command_hide_fft(int argc, char **argv) {
                                     .description = "Path to the payload file (default: stdin)",
                                     .type = ARGUMENT_TYPE_VALUE,
                                     .required = false});
+    argparse_add_argument(
+        &parser, (Argparse_Options){.short_name = 'b',
+                                    .long_name = "blind",
+                                    .description = "Hide raw bytes that can be extracted without the original image (default: false)",
+                                    .type = ARGUMENT_TYPE_FLAG,
+                                    .required = false});
+    argparse_add_argument(
+        &parser, (Argparse_Options){.short_name = 'k',
+                                    .long_name = "key",
+                                    .description = "Key for the blind mode pattern, required with --blind",
+                                    .type = ARGUMENT_TYPE_VALUE,
+                                    .required = false});
+
+    argparse_add_argument(
+        &parser, (Argparse_Options){.short_name = 'C',
+                                    .long_name = "crc",
+                                    .description = "Add a CRC32C integrity check to the payload, blind mode only (default: false)",
+                                    .type = ARGUMENT_TYPE_FLAG,
+                                    .required = false});
 
     if (argparse_parse(&parser, argc, argv) != ARG_OK) {
         argparse_print_help(&parser);
@@ -319,9 +687,18 @@ static int command_hide_fft(int argc, char **argv) {
     args.image_path = argparse_get_value(&parser, "image");
     args.output_path = argparse_get_value_or_default(&parser, "output", NULL);
     args.payload_path = argparse_get_value_or_default(&parser, "payload", NULL);
+    args.blind = argparse_get_flag(&parser, "blind");
+    args.key = argparse_get_value_or_default(&parser, "key", NULL);
+    args.crc = argparse_get_flag(&parser, "crc");
 
     argparse_parser_free(&parser);
 
+    command__check_fft_key(args.blind, args.key);
+    if (args.crc && !args.blind) {
+        aids_log(AIDS_ERROR, "--crc needs --blind");
+        exit(EXIT_FAILURE);
+    }
+
     int width, height, num_chan;
     uint8_t *bytes = stbi_load(args.image_path, &width, &height, &num_chan, 0);
     if (bytes == NULL) {
@@ -331,7 +708,23 @@ static int command_hide_fft(int argc, char **argv) {
 
     const uint8_t *payload = NULL;
     size_t payload_width = 0, payload_height = 0, payload_chan = 0;
-    if (args.payload_path != NULL) {
+    if (args.blind) {
+        Aids_String_Slice payload_slice = {0};
+        if (aids_io_read(args.payload_path, &payload_slice, "rb") != AIDS_OK) {
+            aids_log(AIDS_ERROR, "Error reading payload file: %s", aids_failure_reason());
+            exit(EXIT_FAILURE);
+        }
+        if (args.crc) {
+            command__integrity_wrap(&payload_slice.str, &payload_slice.len);
+        }
+
+        if (steg_hide_fft_blind(bytes, width, height, num_chan, payload_slice.str, payload_slice.len,
+                                key_from_string(args.key)) != STEG_OK) {
+            aids_log(AIDS_ERROR, "Error hiding message in image: %s", steg_failure_reason());
+            exit(EXIT_FAILURE);
+        }
+        AIDS_FREE(payload_slice.str);
+    } else if (args.payload_path != NULL) {
         int width, height, num_chan;
         uint8_t *pimage_bytes = stbi_load(args.payload_path, &width, &height, &num_chan, 0);
         if (pimage_bytes == NULL) {
@@ -347,7 +740,7 @@ static int command_hide_fft(int argc, char **argv) {
         AIDS_TODO("Reading payload from stdin is not implemented for FFT hiding");
     }
 
-    if (steg_hide_fft(bytes, width, height, num_chan, (const uint8_t *)payload, payload_width, payload_height, payload_chan) != STEG_OK) {
+    if (!args.blind && steg_hide_fft(bytes, width, height, num_chan, (const uint8_t *)payload, payload_width, payload_height, payload_chan) != STEG_OK) {
         aids_log(AIDS_ERROR, "Error hiding message in image: %s", steg_failure_reason());
         exit(EXIT_FAILURE);
     }
@@ -378,6 +771,9 @@ typedef struct {
     const char *og_image_path; // Path to the original image file
     const char *image_path; // Path to the image file
     const char *output_path; // Path to save the modified image (default: stdout)
+    bool blind;             // Extract a blind mode payload (no original image)
+    const char *key;        // Key for the blind mode pattern
+    bool crc;               // Check the CRC32C integrity framing (blind mode)
 } Steg_Show_Args_Fft;
 
 static int command_show_fft(int argc, char **argv) {
@@ -390,22 +786,41 @@ static int command_show_fft(int argc, char **argv) {
     argparse_add_argument(
         &parser, (Argparse_Options){.short_name = 'g',
                                     .long_name = "og-image",
-                                    .description = "Path to the original image file",
+                                    .description = "Path to the original image file (the image file itself with --blind)",
                                     .type = ARGUMENT_TYPE_POSITIONAL,
                                     .required = true});
 
     argparse_add_argument(
         &parser, (Argparse_Options){.short_name = 'i',
                                     .long_name = "image",
-                                    .description = "Path to the image file",
+                                    .description = "Path to the image file, left out with --blind",
                                     .type = ARGUMENT_TYPE_POSITIONAL,
-                                    .required = true});
+                                    .required = false});
     argparse_add_argument(
         &parser, (Argparse_Options){.short_name = 'o',
                                     .long_name = "output",
                                     .description = "Path to save the modified image (default: stdout)",
                                     .type = ARGUMENT_TYPE_VALUE,
                                     .required = false});
+    argparse_add_argument(
+        &parser, (Argparse_Options){.short_name = 'b',
+                                    .long_name = "blind",
+                                    .description = "Extract a payload hidden with --blind (default: false)",
+                                    .type = ARGUMENT_TYPE_FLAG,
+                                    .required = false});
+    argparse_add_argument(
+        &parser, (Argparse_Options){.short_name = 'k',
+                                    .long_name = "key",
+                                    .description = "Key for the blind mode pattern, required with --blind",
+                                    .type = ARGUMENT_TYPE_VALUE,
+                                    .required = false});
+
+    argparse_add_argument(
+        &parser, (Argparse_Options){.short_name = 'C',
+                                    .long_name = "crc",
+                                    .description = "Check the CRC32C of a payload hidden with --crc, stopping early on covers without one, blind mode only (default: false)",
+                                    .type = ARGUMENT_TYPE_FLAG,
+                                    .required = false});
 
     if (argparse_parse(&parser, argc, argv) != ARG_OK) {
         argparse_print_help(&parser);
@@ -413,11 +828,33 @@ static int command_show_fft(int argc, char **argv) {
     }
 
     args.og_image_path = argparse_get_value(&parser, "og-image");
-    args.image_path = argparse_get_value(&parser, "image");
+    args.image_path = argparse_get_value_or_default(&parser, "image", NULL);
     args.output_path = argparse_get_value_or_default(&parser, "output", NULL);
+    args.blind = argparse_get_flag(&parser, "blind");
+    args.key = argparse_get_value_or_default(&parser, "key", NULL);
+    args.crc = argparse_get_flag(&parser, "crc");
 
     argparse_parser_free(&parser);
 
+    command__check_fft_key(args.blind, args.key);
+    if (args.blind) {
+        // Blind extraction only needs the stego image, given on its own
+        if (args.image_path != NULL) {
+            aids_log(AIDS_ERROR, "--blind takes only the image file, not the original");
+            exit(EXIT_FAILURE);
+        }
+        args.image_path = args.og_image_path;
+        args.og_image_path = NULL;
+    }
+    if (args.crc && !args.blind) {
+        aids_log(AIDS_ERROR, "--crc needs --blind");
+        exit(EXIT_FAILURE);
+    }
+    if (args.image_path == NULL) {
+        aids_log(AIDS_ERROR, "Missing the image file (the original image is required without --blind)");
+        exit(EXIT_FAILURE);
+    }
+
     int width, height, num_chan;
     uint8_t *bytes = stbi_load(args.image_path, &width, &height, &num_chan, 0);
     if (bytes == NULL) {
@@ -425,6 +862,35 @@ static int command_show_fft(int argc, char **argv) {
         exit(EXIT_FAILURE);
     }
 
+    if (args.blind) {
+        size_t message_length = 0;
+        if (steg_show_fft_blind(bytes, width, height, num_chan, key_from_string(args.key), &message, &message_length) != STEG_OK) {
+            aids_log(AIDS_ERROR, "Error showing message from image: %s", steg_failure_reason());
+            exit(EXIT_FAILURE);
+        }
+        if (args.crc) {
+            command__integrity_unwrap(message, &message_length);
+        }
+
+        if (args.output_path == NULL) {
+            printf("Hidden message: %.*s\n", (int)message_length, message);
+        } else {
+            Aids_String_Slice message_slice = {
+                .str = (unsigned char *)message,
+                .len = message_length
+            };
+            if (aids_io_write(args.output_path, &message_slice, "wb") != AIDS_OK) {
+                aids_log(AIDS_ERROR, "Error writing message to output file: %s", aids_failure_reason());
+                exit(EXIT_FAILURE);
+            }
+            aids_log(AIDS_INFO, "Hidden message written to %s", args.output_path);
+        }
+
+        stbi_image_free(bytes);
+        AIDS_FREE(message);
+        return 0;
+    }
+
     int og_width, og_height, og_num_chan;
     uint8_t *og_bytes = stbi_load(args.og_image_path, &og_width, &og_height, &og_num_chan, 0);
     if (og_bytes == NULL) {
@@ -475,8 +941,55 @@ typedef struct {
     const char *output_path; // Path to save the modified image
     const char *payload_path; // Path to the payload file (default: stdin)
     size_t compression_level; // Compression level to use (default: 1)
+    int quality;              // JPEG quality of the output, 0 for a PNG (default: 0)
+    bool luma;                // Embed in the luma plane only (default: false)
+    size_t block_size;        // DCT block size, 4, 8 or 16 (default: 8)
+    bool crc;                 // Add a CRC32C integrity check (default: false)
+    bool compress;            // Deflate the payload (default: false)
 } Steg_Hide_Args_Dct;
 
+// Whether path ends in .jpg or .jpeg, in any case
+static bool command__is_jpeg_path(const char *path) {
+    const char *dot = strrchr(path, '.');
+    if (dot == NULL) {
+        return false;
+    }
+
+    char extension[6] = {0};
+    size_t length = strlen(dot);
+    if (length >= sizeof(extension)) {
+        return false;
+    }
+    for (size_t i = 0; i < length; i++) {
+        extension[i] = (char)tolower((unsigned char)dot[i]);
+    }
+    return strcmp(extension, ".jpg") == 0 || strcmp(extension, ".jpeg") == 0;
+}
+
+#define COMMAND_JPEG_BLOCK_SIZE 8
+
+// The JPEG path embeds in the 8x8 coefficients of every component, so the
+// pixel domain knobs do not apply to it
+static void command__check_jpeg_options(bool luma, size_t block_size) {
+    if (luma) {
+        aids_log(AIDS_ERROR, "--luma does not apply to JPEG images");
+        exit(EXIT_FAILURE);
+    }
+    if (block_size != 0 && block_size != COMMAND_JPEG_BLOCK_SIZE) {
+        aids_log(AIDS_ERROR, "JPEG images always use %d x %d blocks", COMMAND_JPEG_BLOCK_SIZE, COMMAND_JPEG_BLOCK_SIZE);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// stbi_write_func that collects the encoded image in an Aids_Array of bytes
+static void command__append_bytes(void *context, void *data, int size) {
+    Aids_Array *bytes = context;
+    if (aids_array_append_many(bytes, data, size) != AIDS_OK) {
+        aids_log(AIDS_ERROR, "Error encoding image: %s", aids_failure_reason());
+        exit(EXIT_FAILURE);
+    }
+}
+
 static int command_hide_dct(int argc, char **argv) {
     Steg_Hide_Args_Dct args = {0};
 
@@ -506,9 +1019,41 @@ static int command_hide_dct(int argc, char **argv) {
     argparse_add_argument(
         &parser, (Argparse_Options){.short_name = 'c',
                                     .long_name = "compression",
-                                    .description = "Compression level (default: 1)",
+                                    .description = "Coefficients per block, 1-8 (default: 1)",
+                                    .type = ARGUMENT_TYPE_VALUE,
+                                    .required = false});
+    argparse_add_argument(
+        &parser, (Argparse_Options){.short_name = 'q',
+                                    .long_name = "quality",
+                                    .description = "Write a JPEG of this quality, 1-100 (default: PNG, or the JPEG cover's own)",
                                     .type = ARGUMENT_TYPE_VALUE,
                                     .required = false});
+    argparse_add_argument(
+        &parser, (Argparse_Options){.short_name = 'l',
+                                    .long_name = "luma",
+                                    .description = "Embed in the luma of RGB covers only (default: false)",
+                                    .type = ARGUMENT_TYPE_FLAG,
+                                    .required = false});
+    argparse_add_argument(
+        &parser, (Argparse_Options){.short_name = 'b',
+                                    .long_name = "block-size",
+                                    .description = "DCT block size of non-JPEG covers, 4, 8 or 16 (default: 8)",
+                                    .type = ARGUMENT_TYPE_VALUE,
+                                    .required = false});
+
+    argparse_add_argument(
+        &parser, (Argparse_Options){.short_name = 'C',
+                                    .long_name = "crc",
+                                    .description = "Add a CRC32C integrity check to the payload (default: false)",
+                                    .type = ARGUMENT_TYPE_FLAG,
+                                    .required = false});
+
+    argparse_add_argument(
+        &parser, (Argparse_Options){.short_name = 'z',
+                                    .long_name = "compress",
+                                    .description = "Deflate the payload before hiding it, show-* inflates it on its own (default: false)",
+                                    .type = ARGUMENT_TYPE_FLAG,
+                                    .required = false});
 
     if (argparse_parse(&parser, argc, argv) != ARG_OK) {
         argparse_print_help(&parser);
@@ -520,40 +1065,128 @@ static int command_hide_dct(int argc, char **argv) {
     args.payload_path = argparse_get_value_or_default(&parser, "payload", NULL);
     const char *compression_str = argparse_get_value_or_default(&parser, "compression", "1");
     args.compression_level = atoi(compression_str);
+    const char *quality_str = argparse_get_value_or_default(&parser, "quality", "0");
+    args.quality = atoi(quality_str);
+    args.luma = argparse_get_flag(&parser, "luma");
+    const char *block_size_str = argparse_get_value_or_default(&parser, "block-size", "0");
+    args.block_size = atoi(block_size_str);
+    args.crc = argparse_get_flag(&parser, "crc");
+    args.compress = argparse_get_flag(&parser, "compress");
 
     argparse_parser_free(&parser);
 
-    int width, height, num_chan;
-    uint8_t *bytes = stbi_load(args.image_path, &width, &height, &num_chan, 0);
-    if (bytes == NULL) {
-        aids_log(AIDS_ERROR, "Error loading image: %s", stbi_failure_reason());
+    if (args.quality < 0 || args.quality > 100) {
+        aids_log(AIDS_ERROR, "Invalid JPEG quality: %d", args.quality);
+        exit(EXIT_FAILURE);
+    }
+
+    Aids_String_Slice image_slice = {0};
+    if (aids_io_read(args.image_path, &image_slice, "rb") != AIDS_OK) {
+        aids_log(AIDS_ERROR, "Error reading image file: %s", aids_failure_reason());
         exit(EXIT_FAILURE);
     }
 
+    // A quality or a JPEG cover writes a JPEG, anything else a PNG, whatever
+    // the extension of the output
+    bool to_jpeg = args.quality > 0 || jpeg_is_jpeg(image_slice.str, image_slice.len);
+    if (to_jpeg) {
+        command__check_jpeg_options(args.luma, args.block_size);
+    }
+    if (args.output_path != NULL && command__is_jpeg_path(args.output_path) != to_jpeg) {
+        aids_log(AIDS_ERROR, "The output is a %s image, %s does not match", to_jpeg ? "JPEG" : "PNG", args.output_path);
+        exit(EXIT_FAILURE);
+    }
+
+    // With a quality, the cover is first compressed with stbi_write_jpg and the
+    // payload goes into the coefficients quantized with that quality's tables,
+    // so the JPEG that is written is exactly the one the extractor reads
+    const uint8_t *jpeg = NULL;
+    size_t jpeg_size = 0;
+    Aids_Array encoded = {0};
+    aids_array_init(&encoded, sizeof(unsigned char));
+    if (args.quality > 0) {
+        int width, height, num_chan;
+        uint8_t *bytes = stbi_load_from_memory(image_slice.str, image_slice.len, &width, &height, &num_chan, 0);
+        if (bytes == NULL) {
+            aids_log(AIDS_ERROR, "Error loading image: %s", stbi_failure_reason());
+            exit(EXIT_FAILURE);
+        }
+        if (stbi_write_jpg_to_func(command__append_bytes, &encoded, width, height, num_chan, bytes, args.quality) == 0) {
+            aids_log(AIDS_ERROR, "Error encoding image as JPEG");
+            exit(EXIT_FAILURE);
+        }
+        stbi_image_free(bytes);
+        jpeg = encoded.items;
+        jpeg_size = encoded.count;
+    } else if (jpeg_is_jpeg(image_slice.str, image_slice.len)) {
+        jpeg = image_slice.str;
+        jpeg_size = image_slice.len;
+    }
+
     Aids_String_Slice payload_slice = {0};
     if (aids_io_read(args.payload_path, &payload_slice, "rb") != AIDS_OK) {
         aids_log(AIDS_ERROR, "Error reading payload file: %s", aids_failure_reason());
         exit(EXIT_FAILURE);
     }
+    uint8_t flags = 0;
+    if (args.compress && command__deflate(&payload_slice.str, &payload_slice.len)) {
+        flags |= STEG_PAYLOAD_COMPRESSED;
+    }
+    if (args.crc) {
+        command__integrity_wrap(&payload_slice.str, &payload_slice.len);
+    }
     const uint8_t *payload = (const uint8_t *)payload_slice.str;
     size_t payload_length = payload_slice.len;
 
-    if (steg_hide_dct(bytes, width, height, num_chan, (const uint8_t *)payload, payload_length, args.compression_level) != STEG_OK) {
-        aids_log(AIDS_ERROR, "Error hiding message in image: %s", steg_failure_reason());
-        exit(EXIT_FAILURE);
-    }
+    if (jpeg != NULL) {
+        // Embed straight into the quantized coefficients and keep the JPEG format
+        Aids_String_Slice output_slice = {0};
+        if (steg_hide_jpeg(jpeg, jpeg_size, payload, payload_length, args.compression_level, flags,
+                           &output_slice.str, &output_slice.len) != STEG_OK) {
+            aids_log(AIDS_ERROR, "Error hiding message in image: %s", steg_failure_reason());
+            exit(EXIT_FAILURE);
+        }
+        if (aids_io_write(args.output_path, &output_slice, "wb") != AIDS_OK) {
+            aids_log(AIDS_ERROR, "Error saving modified image: %s", aids_failure_reason());
+            exit(EXIT_FAILURE);
+        }
+        free(output_slice.str);
+    } else {
+        int width, height, num_chan;
+        uint8_t *bytes = stbi_load_from_memory(image_slice.str, image_slice.len, &width, &height, &num_chan, 0);
+        if (bytes == NULL) {
+            aids_log(AIDS_ERROR, "Error loading image: %s", stbi_failure_reason());
+            exit(EXIT_FAILURE);
+        }
 
-    if (stbi_write_png(args.output_path, width, height, num_chan, bytes, width * num_chan) == 0) {
-        aids_log(AIDS_ERROR, "Error saving modified image: %s", stbi_failure_reason());
-        exit(EXIT_FAILURE);
-    }
+        Steg_Dct_Options options = {
+            .compression = args.compression_level,
+            .block_size = args.block_size,
+            .luma = args.luma,
+            .flags = flags,
+        };
+        size_t errors = 0;
+        if (steg_hide_dct_ex(bytes, width, height, num_chan, payload, payload_length, &options, &errors) != STEG_OK) {
+            aids_log(AIDS_ERROR, "Error hiding message in image: %s", steg_failure_reason());
+            exit(EXIT_FAILURE);
+        }
+        if (errors > 0) {
+            aids_log(AIDS_WARNING, "%zu embedded bits did not survive the conversion to 8 bits", errors);
+        }
 
-    aids_log(AIDS_INFO, "Message hidden successfully in %s", args.output_path);
+        if (stbi_write_png(args.output_path, width, height, num_chan, bytes, width * num_chan) == 0) {
+            aids_log(AIDS_ERROR, "Error saving modified image: %s", stbi_failure_reason());
+            exit(EXIT_FAILURE);
+        }
 
-    if (bytes != NULL) {
         stbi_image_free(bytes);
     }
 
+    aids_log(AIDS_INFO, "Message hidden successfully in %s", args.output_path);
+
+    aids_array_free(&encoded);
+    AIDS_FREE(image_slice.str);
+
     if (payload != NULL) {
         if (args.payload_path != NULL) {
             stbi_image_free((void *)payload);
@@ -569,6 +1202,9 @@ typedef struct {
     const char *image_path; // Path to the image file
     const char *output_path; // Path to save the modified image (default: stdout)
     size_t compression_level; // Compression level to use (default: 1)
+    bool luma; // Extract from the luma plane only (default: false)
+    size_t block_size; // DCT block size, 4, 8 or 16 (default: 8)
+    bool crc; // Check the CRC32C integrity framing (default: false)
 } Steg_Show_Args_Dct;
 
 static int command_show_dct(int argc, char **argv) {
@@ -594,9 +1230,28 @@ static int command_show_dct(int argc, char **argv) {
     argparse_add_argument(
         &parser, (Argparse_Options){.short_name = 'c',
                                     .long_name = "compression",
-                                    .description = "Compression level (default: 1)",
+                                    .description = "Coefficients per block, 1-8 (default: 1)",
                                     .type = ARGUMENT_TYPE_VALUE,
                                     .required = false});
+    argparse_add_argument(
+        &parser, (Argparse_Options){.short_name = 'l',
+                                    .long_name = "luma",
+                                    .description = "Extract from the luma of RGB covers only (default: false)",
+                                    .type = ARGUMENT_TYPE_FLAG,
+                                    .required = false});
+    argparse_add_argument(
+        &parser, (Argparse_Options){.short_name = 'b',
+                                    .long_name = "block-size",
+                                    .description = "DCT block size of non-JPEG covers, 4, 8 or 16 (default: 8)",
+                                    .type = ARGUMENT_TYPE_VALUE,
+                                    .required = false});
+
+    argparse_add_argument(
+        &parser, (Argparse_Options){.short_name = 'C',
+                                    .long_name = "crc",
+                                    .description = "Check the CRC32C of a payload hidden with --crc, stopping early on covers without one (default: false)",
+                                    .type = ARGUMENT_TYPE_FLAG,
+                                    .required = false});
 
     if (argparse_parse(&parser, argc, argv) != ARG_OK) {
         argparse_print_help(&parser);
@@ -607,19 +1262,54 @@ static int command_show_dct(int argc, char **argv) {
     args.output_path = argparse_get_value_or_default(&parser, "output", NULL);
     const char *compression_str = argparse_get_value_or_default(&parser, "compression", "1");
     args.compression_level = atoi(compression_str);
+    args.luma = argparse_get_flag(&parser, "luma");
+    const char *block_size_str = argparse_get_value_or_default(&parser, "block-size", "0");
+    args.block_size = atoi(block_size_str);
+    args.crc = argparse_get_flag(&parser, "crc");
 
     argparse_parser_free(&parser);
 
-    int width, height, num_chan;
-    uint8_t *bytes = stbi_load(args.image_path, &width, &height, &num_chan, 0);
-    if (bytes == NULL) {
-        aids_log(AIDS_ERROR, "Error loading image: %s", stbi_failure_reason());
+    Aids_String_Slice image_slice = {0};
+    if (aids_io_read(args.image_path, &image_slice, "rb") != AIDS_OK) {
+        aids_log(AIDS_ERROR, "Error reading image file: %s", aids_failure_reason());
         exit(EXIT_FAILURE);
     }
 
-    if (steg_show_dct(bytes, width, height, num_chan, &message, &message_length, args.compression_level) != STEG_OK) {
-        aids_log(AIDS_ERROR, "Error showing message from image: %s", steg_failure_reason());
-        exit(EXIT_FAILURE);
+    uint8_t flags = 0;
+    if (jpeg_is_jpeg(image_slice.str, image_slice.len)) {
+        command__check_jpeg_options(args.luma, args.block_size);
+        if (steg_show_jpeg(image_slice.str, image_slice.len, &message, &message_length, args.compression_level, args.crc,
+                           &flags) != STEG_OK) {
+            aids_log(AIDS_ERROR, "Error showing message from image: %s", steg_failure_reason());
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        int width, height, num_chan;
+        uint8_t *bytes = stbi_load_from_memory(image_slice.str, image_slice.len, &width, &height, &num_chan, 0);
+        if (bytes == NULL) {
+            aids_log(AIDS_ERROR, "Error loading image: %s", stbi_failure_reason());
+            exit(EXIT_FAILURE);
+        }
+
+        Steg_Dct_Options options = {
+            .compression = args.compression_level,
+            .block_size = args.block_size,
+            .luma = args.luma,
+            .integrity = args.crc,
+        };
+        if (steg_show_dct_ex(bytes, width, height, num_chan, &message, &message_length, &options, &flags) != STEG_OK) {
+            aids_log(AIDS_ERROR, "Error showing message from image: %s", steg_failure_reason());
+            exit(EXIT_FAILURE);
+        }
+
+        stbi_image_free(bytes);
+    }
+
+    if (args.crc) {
+        command__integrity_unwrap(message, &message_length);
+    }
+    if (flags & STEG_PAYLOAD_COMPRESSED) {
+        command__inflate(&message, &message_length);
     }
 
     if (message_length > 0) {
@@ -648,9 +1338,7 @@ static int command_show_dct(int argc, char **argv) {
         printf("No hidden message found in the image.\n");
     }
 
-    if (bytes != NULL) {
-        stbi_image_free(bytes);
-    }
+    AIDS_FREE(image_slice.str);
     if (message != NULL) {
         AIDS_FREE(message);
     }
@@ -658,6 +1346,9 @@ static int command_show_dct(int argc, char **argv) {
     return 0;
 }
 
+// Bits in one Hamming(7,4) codeword of the --ecc stream
+#define COMMAND_HAMMING_CODEWORD_BITS 7
+
 typedef struct {
     const char *image_path;  // Path to the image file
     const char *output_path; // Path to save the modified image
@@ -712,15 +1403,15 @@ static int command_noise_lsb(int argc, char **argv) {
         exit(EXIT_FAILURE);
     }
 
-    // Insert dummy error
-    size_t stride = 8 / args.compression_level;
-    for (size_t i = 0; i < (size_t)(width * height * num_chan); i += stride) {
+    // Insert dummy error, at most one bit in each 7-bit window of the hidden
+    // stream so every packed Hamming codeword stays correctable. Stream bit b
+    // sits in bit (compression - 1 - b % compression) of sample b / compression.
+    size_t stream_bits = (size_t)(width * height * num_chan) * args.compression_level;
+    for (size_t i = 0; i + COMMAND_HAMMING_CODEWORD_BITS <= stream_bits; i += COMMAND_HAMMING_CODEWORD_BITS) {
         if ((double)rand() / RAND_MAX >= 0.5) {
-            size_t byte_index = i + rand() % stride;
-            uint8_t byte = bytes[byte_index];
-            size_t index = rand() % args.compression_level;
-            byte = byte ^ (1 << index);
-            bytes[byte_index] = byte;
+            size_t bit = i + rand() % COMMAND_HAMMING_CODEWORD_BITS;
+            size_t index = args.compression_level - 1 - bit % args.compression_level;
+            bytes[bit / args.compression_level] ^= 1 << index;
         }
     }
 
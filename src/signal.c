@@ -1,8 +1,17 @@
 #include <complex.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <assert.h>
 
+// The AVX2 batch kernels are compiled with a function target attribute and
+// picked at run time, so the default build uses them without -m flags
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DCT_X86_DISPATCH
+#define DCT_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+
 #include "signal.h"
 
 void fft_simple(const complex double *x, unsigned long n, complex double *x_out) {
@@ -158,40 +167,697 @@ void ifft2d(const complex double *x, unsigned long width, unsigned long height,
     free(tmp);
 }
 
-static inline double alpha(int k) {
-    return (k == 0) ? sqrt(1.0 / BLOCK_SIZE) : sqrt(2.0 / BLOCK_SIZE);
+// AAN (Arai, Agui, Nakajima) factorization of the 8-point DCT, as used by the
+// float DCT in libjpeg: 5 multiplies and 29 additions per 1-D transform. Its
+// outputs are scaled by AAN_SCALE[k] * sqrt(8), folded into the tables below so
+// that dct2d/idct2d stay orthonormal.
+#define AAN_C4 0.707106781186547524
+#define AAN_C6 0.382683432365089772
+#define AAN_C2_MINUS_C6 0.541196100146196985
+#define AAN_C2_PLUS_C6 1.306562964876376527
+#define AAN_SQRT2 1.414213562373095049
+#define AAN_2C2 1.847759065022573512
+#define AAN_2C2_MINUS_2C6 1.082392200292393968
+#define AAN_2C2_PLUS_2C6 2.613125929752753055
+
+// 1 / (sqrt(8) * AAN_SCALE[k]) with AAN_SCALE[0] = 1, AAN_SCALE[k] = sqrt(2) * cos(k * pi / 16)
+static const double AAN_FORWARD_SCALE[BLOCK_SIZE] = {
+    0.353553390593273762, 0.254897789552079584, 0.270598050073098492, 0.300672443467522640,
+    0.353553390593273762, 0.449988111568207852, 0.653281482438188264, 1.281457723870753089,
+};
+
+// AAN_SCALE[k] / sqrt(8)
+static const double AAN_INVERSE_SCALE[BLOCK_SIZE] = {
+    0.353553390593273762, 0.490392640201615225, 0.461939766255643378, 0.415734806151272619,
+    0.353553390593273762, 0.277785116509801112, 0.191341716182544886, 0.097545161008064133,
+};
+
+static inline void dct__aan_1d(double *d, size_t stride) {
+    double tmp0 = d[0 * stride] + d[7 * stride];
+    double tmp7 = d[0 * stride] - d[7 * stride];
+    double tmp1 = d[1 * stride] + d[6 * stride];
+    double tmp6 = d[1 * stride] - d[6 * stride];
+    double tmp2 = d[2 * stride] + d[5 * stride];
+    double tmp5 = d[2 * stride] - d[5 * stride];
+    double tmp3 = d[3 * stride] + d[4 * stride];
+    double tmp4 = d[3 * stride] - d[4 * stride];
+
+    // Even part
+    double tmp10 = tmp0 + tmp3;
+    double tmp13 = tmp0 - tmp3;
+    double tmp11 = tmp1 + tmp2;
+    double tmp12 = tmp1 - tmp2;
+
+    d[0 * stride] = tmp10 + tmp11;
+    d[4 * stride] = tmp10 - tmp11;
+
+    double z1 = (tmp12 + tmp13) * AAN_C4;
+    d[2 * stride] = tmp13 + z1;
+    d[6 * stride] = tmp13 - z1;
+
+    // Odd part
+    tmp10 = tmp4 + tmp5;
+    tmp11 = tmp5 + tmp6;
+    tmp12 = tmp6 + tmp7;
+
+    double z5 = (tmp10 - tmp12) * AAN_C6;
+    double z2 = AAN_C2_MINUS_C6 * tmp10 + z5;
+    double z4 = AAN_C2_PLUS_C6 * tmp12 + z5;
+    double z3 = tmp11 * AAN_C4;
+
+    double z11 = tmp7 + z3;
+    double z13 = tmp7 - z3;
+
+    d[5 * stride] = z13 + z2;
+    d[3 * stride] = z13 - z2;
+    d[1 * stride] = z11 + z4;
+    d[7 * stride] = z11 - z4;
+}
+
+static inline void idct__aan_1d(double *d, size_t stride) {
+    // Even part
+    double tmp0 = d[0 * stride];
+    double tmp1 = d[2 * stride];
+    double tmp2 = d[4 * stride];
+    double tmp3 = d[6 * stride];
+
+    double tmp10 = tmp0 + tmp2;
+    double tmp11 = tmp0 - tmp2;
+    double tmp13 = tmp1 + tmp3;
+    double tmp12 = (tmp1 - tmp3) * AAN_SQRT2 - tmp13;
+
+    tmp0 = tmp10 + tmp13;
+    tmp3 = tmp10 - tmp13;
+    tmp1 = tmp11 + tmp12;
+    tmp2 = tmp11 - tmp12;
+
+    // Odd part
+    double tmp4 = d[1 * stride];
+    double tmp5 = d[3 * stride];
+    double tmp6 = d[5 * stride];
+    double tmp7 = d[7 * stride];
+
+    double z13 = tmp6 + tmp5;
+    double z10 = tmp6 - tmp5;
+    double z11 = tmp4 + tmp7;
+    double z12 = tmp4 - tmp7;
+
+    tmp7 = z11 + z13;
+    tmp11 = (z11 - z13) * AAN_SQRT2;
+
+    double z5 = (z10 + z12) * AAN_2C2;
+    tmp10 = AAN_2C2_MINUS_2C6 * z12 - z5;
+    tmp12 = -AAN_2C2_PLUS_2C6 * z10 + z5;
+
+    tmp6 = tmp12 - tmp7;
+    tmp5 = tmp11 - tmp6;
+    tmp4 = tmp10 + tmp5;
+
+    d[0 * stride] = tmp0 + tmp7;
+    d[7 * stride] = tmp0 - tmp7;
+    d[1 * stride] = tmp1 + tmp6;
+    d[6 * stride] = tmp1 - tmp6;
+    d[2 * stride] = tmp2 + tmp5;
+    d[5 * stride] = tmp2 - tmp5;
+    d[4 * stride] = tmp3 + tmp4;
+    d[3 * stride] = tmp3 - tmp4;
 }
 
 void dct2d(const double x[BLOCK_SIZE][BLOCK_SIZE], double X[BLOCK_SIZE][BLOCK_SIZE]) {
+    memcpy(X, x, sizeof(double) * BLOCK_SIZE * BLOCK_SIZE);
+
+    for (size_t i = 0; i < BLOCK_SIZE; i++) {
+        dct__aan_1d(X[i], 1);
+    }
+    for (size_t j = 0; j < BLOCK_SIZE; j++) {
+        dct__aan_1d(&X[0][j], BLOCK_SIZE);
+    }
+
     for (size_t k1 = 0; k1 < BLOCK_SIZE; k1++) {
         for (size_t k2 = 0; k2 < BLOCK_SIZE; k2++) {
-            double sum = 0;
-            for (size_t n1 = 0; n1 < BLOCK_SIZE; n1++) {
-                for (size_t n2 = 0; n2 < BLOCK_SIZE; n2++) {
-                    sum += x[n1][n2] *
-                        cos(M_PI / BLOCK_SIZE * (n1 + 0.5) * k1) *
-                        cos(M_PI / BLOCK_SIZE * (n2 + 0.5) * k2);
-                }
-            }
-
-            X[k1][k2] = alpha(k1) * alpha(k2) * sum;
+            X[k1][k2] *= AAN_FORWARD_SCALE[k1] * AAN_FORWARD_SCALE[k2];
         }
     }
 }
 
 void idct2d(const double X[BLOCK_SIZE][BLOCK_SIZE], double x[BLOCK_SIZE][BLOCK_SIZE]) {
+    for (size_t k1 = 0; k1 < BLOCK_SIZE; k1++) {
+        for (size_t k2 = 0; k2 < BLOCK_SIZE; k2++) {
+            x[k1][k2] = X[k1][k2] * AAN_INVERSE_SCALE[k1] * AAN_INVERSE_SCALE[k2];
+        }
+    }
+
+    for (size_t j = 0; j < BLOCK_SIZE; j++) {
+        idct__aan_1d(&x[0][j], BLOCK_SIZE);
+    }
+    for (size_t i = 0; i < BLOCK_SIZE; i++) {
+        idct__aan_1d(x[i], 1);
+    }
+}
+
+// Integer DCT after libjpeg's jfdctint.c/jidctint.c ("islow"): 13-bit fixed
+// point constants, with PASS1_BITS of extra precision kept between the passes.
+#define ISLOW_CONST_BITS 13
+#define ISLOW_PASS1_BITS 2
+
+#define ISLOW_FIX_0_298631336 2446
+#define ISLOW_FIX_0_390180644 3196
+#define ISLOW_FIX_0_541196100 4433
+#define ISLOW_FIX_0_765366865 6270
+#define ISLOW_FIX_0_899976223 7373
+#define ISLOW_FIX_1_175875602 9633
+#define ISLOW_FIX_1_501321110 12299
+#define ISLOW_FIX_1_847759065 15137
+#define ISLOW_FIX_1_961570560 16069
+#define ISLOW_FIX_2_053119869 16819
+#define ISLOW_FIX_2_562915447 20995
+#define ISLOW_FIX_3_072711026 25172
+
+// Shifts applied to the outputs of each pass. The forward even outputs are
+// scaled up by 1 << ISLOW_CONST_BITS first, so they share the shift exactly.
+#define ISLOW_FORWARD_SHIFT1 (ISLOW_CONST_BITS - ISLOW_PASS1_BITS)
+#define ISLOW_FORWARD_SHIFT2 (ISLOW_CONST_BITS + ISLOW_PASS1_BITS)
+#define ISLOW_INVERSE_SHIFT1 (ISLOW_CONST_BITS - ISLOW_PASS1_BITS)
+#define ISLOW_INVERSE_SHIFT2 (ISLOW_CONST_BITS + ISLOW_PASS1_BITS + 3)
+
+static inline int32_t dct__descale(int32_t x, int shift) {
+    return (x + (1 << (shift - 1))) >> shift;
+}
+
+static inline int16_t dct__saturate16(int32_t x) {
+    return x < INT16_MIN ? INT16_MIN : x > INT16_MAX ? INT16_MAX : (int16_t)x;
+}
+
+static inline void dct__islow_1d(int32_t *d, size_t stride, int shift) {
+    int32_t tmp0 = d[0 * stride] + d[7 * stride];
+    int32_t tmp7 = d[0 * stride] - d[7 * stride];
+    int32_t tmp1 = d[1 * stride] + d[6 * stride];
+    int32_t tmp6 = d[1 * stride] - d[6 * stride];
+    int32_t tmp2 = d[2 * stride] + d[5 * stride];
+    int32_t tmp5 = d[2 * stride] - d[5 * stride];
+    int32_t tmp3 = d[3 * stride] + d[4 * stride];
+    int32_t tmp4 = d[3 * stride] - d[4 * stride];
+
+    // Even part
+    int32_t tmp10 = tmp0 + tmp3;
+    int32_t tmp13 = tmp0 - tmp3;
+    int32_t tmp11 = tmp1 + tmp2;
+    int32_t tmp12 = tmp1 - tmp2;
+
+    d[0 * stride] = dct__descale((tmp10 + tmp11) * (1 << ISLOW_CONST_BITS), shift);
+    d[4 * stride] = dct__descale((tmp10 - tmp11) * (1 << ISLOW_CONST_BITS), shift);
+
+    int32_t z1 = (tmp12 + tmp13) * ISLOW_FIX_0_541196100;
+    d[2 * stride] = dct__descale(z1 + tmp13 * ISLOW_FIX_0_765366865, shift);
+    d[6 * stride] = dct__descale(z1 - tmp12 * ISLOW_FIX_1_847759065, shift);
+
+    // Odd part
+    z1 = tmp4 + tmp7;
+    int32_t z2 = tmp5 + tmp6;
+    int32_t z3 = tmp4 + tmp6;
+    int32_t z4 = tmp5 + tmp7;
+    int32_t z5 = (z3 + z4) * ISLOW_FIX_1_175875602;
+
+    tmp4 *= ISLOW_FIX_0_298631336;
+    tmp5 *= ISLOW_FIX_2_053119869;
+    tmp6 *= ISLOW_FIX_3_072711026;
+    tmp7 *= ISLOW_FIX_1_501321110;
+    z1 *= -ISLOW_FIX_0_899976223;
+    z2 *= -ISLOW_FIX_2_562915447;
+    z3 = z3 * -ISLOW_FIX_1_961570560 + z5;
+    z4 = z4 * -ISLOW_FIX_0_390180644 + z5;
+
+    d[7 * stride] = dct__descale(tmp4 + z1 + z3, shift);
+    d[5 * stride] = dct__descale(tmp5 + z2 + z4, shift);
+    d[3 * stride] = dct__descale(tmp6 + z2 + z3, shift);
+    d[1 * stride] = dct__descale(tmp7 + z1 + z4, shift);
+}
+
+static inline void idct__islow_1d(int32_t *d, size_t stride, int shift) {
+    // Even part
+    int32_t z2 = d[2 * stride];
+    int32_t z3 = d[6 * stride];
+    int32_t z1 = (z2 + z3) * ISLOW_FIX_0_541196100;
+    int32_t tmp2 = z1 - z3 * ISLOW_FIX_1_847759065;
+    int32_t tmp3 = z1 + z2 * ISLOW_FIX_0_765366865;
+
+    z2 = d[0 * stride];
+    z3 = d[4 * stride];
+    int32_t tmp0 = (z2 + z3) * (1 << ISLOW_CONST_BITS);
+    int32_t tmp1 = (z2 - z3) * (1 << ISLOW_CONST_BITS);
+
+    int32_t tmp10 = tmp0 + tmp3;
+    int32_t tmp13 = tmp0 - tmp3;
+    int32_t tmp11 = tmp1 + tmp2;
+    int32_t tmp12 = tmp1 - tmp2;
+
+    // Odd part
+    tmp0 = d[7 * stride];
+    tmp1 = d[5 * stride];
+    tmp2 = d[3 * stride];
+    tmp3 = d[1 * stride];
+
+    z1 = tmp0 + tmp3;
+    z2 = tmp1 + tmp2;
+    z3 = tmp0 + tmp2;
+    int32_t z4 = tmp1 + tmp3;
+    int32_t z5 = (z3 + z4) * ISLOW_FIX_1_175875602;
+
+    tmp0 *= ISLOW_FIX_0_298631336;
+    tmp1 *= ISLOW_FIX_2_053119869;
+    tmp2 *= ISLOW_FIX_3_072711026;
+    tmp3 *= ISLOW_FIX_1_501321110;
+    z1 *= -ISLOW_FIX_0_899976223;
+    z2 *= -ISLOW_FIX_2_562915447;
+    z3 = z3 * -ISLOW_FIX_1_961570560 + z5;
+    z4 = z4 * -ISLOW_FIX_0_390180644 + z5;
+
+    tmp0 += z1 + z3;
+    tmp1 += z2 + z4;
+    tmp2 += z2 + z3;
+    tmp3 += z1 + z4;
+
+    d[0 * stride] = dct__descale(tmp10 + tmp3, shift);
+    d[7 * stride] = dct__descale(tmp10 - tmp3, shift);
+    d[1 * stride] = dct__descale(tmp11 + tmp2, shift);
+    d[6 * stride] = dct__descale(tmp11 - tmp2, shift);
+    d[2 * stride] = dct__descale(tmp12 + tmp1, shift);
+    d[5 * stride] = dct__descale(tmp12 - tmp1, shift);
+    d[3 * stride] = dct__descale(tmp13 + tmp0, shift);
+    d[4 * stride] = dct__descale(tmp13 - tmp0, shift);
+}
+
+void dct2d_int(const int16_t x[BLOCK_SIZE][BLOCK_SIZE], int16_t X[BLOCK_SIZE][BLOCK_SIZE]) {
+    int32_t d[BLOCK_SIZE][BLOCK_SIZE];
+    for (size_t i = 0; i < BLOCK_SIZE; i++) {
+        for (size_t j = 0; j < BLOCK_SIZE; j++) {
+            d[i][j] = x[i][j];
+        }
+    }
+
+    for (size_t i = 0; i < BLOCK_SIZE; i++) {
+        dct__islow_1d(d[i], 1, ISLOW_FORWARD_SHIFT1);
+    }
+    for (size_t j = 0; j < BLOCK_SIZE; j++) {
+        dct__islow_1d(&d[0][j], BLOCK_SIZE, ISLOW_FORWARD_SHIFT2);
+    }
+
+    for (size_t k1 = 0; k1 < BLOCK_SIZE; k1++) {
+        for (size_t k2 = 0; k2 < BLOCK_SIZE; k2++) {
+            X[k1][k2] = dct__saturate16(d[k1][k2]);
+        }
+    }
+}
+
+void idct2d_int(const int16_t X[BLOCK_SIZE][BLOCK_SIZE], int16_t x[BLOCK_SIZE][BLOCK_SIZE]) {
+    int32_t d[BLOCK_SIZE][BLOCK_SIZE];
+    for (size_t k1 = 0; k1 < BLOCK_SIZE; k1++) {
+        for (size_t k2 = 0; k2 < BLOCK_SIZE; k2++) {
+            d[k1][k2] = X[k1][k2];
+        }
+    }
+
+    for (size_t j = 0; j < BLOCK_SIZE; j++) {
+        idct__islow_1d(&d[0][j], BLOCK_SIZE, ISLOW_INVERSE_SHIFT1);
+    }
+    for (size_t i = 0; i < BLOCK_SIZE; i++) {
+        idct__islow_1d(d[i], 1, ISLOW_INVERSE_SHIFT2);
+    }
+
+    for (size_t i = 0; i < BLOCK_SIZE; i++) {
+        for (size_t j = 0; j < BLOCK_SIZE; j++) {
+            x[i][j] = dct__saturate16(d[i][j]);
+        }
+    }
+}
+
+#if defined(DCT_X86_DISPATCH)
+// Same as dct__islow_1d/idct__islow_1d with one block per 32-bit lane
+DCT_AVX2 static inline __m256i dct__descale_avx2(__m256i x, int shift) {
+    x = _mm256_add_epi32(x, _mm256_set1_epi32(1 << (shift - 1)));
+    return _mm256_sra_epi32(x, _mm_cvtsi32_si128(shift));
+}
+
+DCT_AVX2 static inline __m256i dct__mul_avx2(__m256i x, int32_t c) {
+    return _mm256_mullo_epi32(x, _mm256_set1_epi32(c));
+}
+
+DCT_AVX2 static inline void dct__islow_1d_avx2(__m256i *d, size_t stride, int shift) {
+    __m256i tmp0 = _mm256_add_epi32(d[0 * stride], d[7 * stride]);
+    __m256i tmp7 = _mm256_sub_epi32(d[0 * stride], d[7 * stride]);
+    __m256i tmp1 = _mm256_add_epi32(d[1 * stride], d[6 * stride]);
+    __m256i tmp6 = _mm256_sub_epi32(d[1 * stride], d[6 * stride]);
+    __m256i tmp2 = _mm256_add_epi32(d[2 * stride], d[5 * stride]);
+    __m256i tmp5 = _mm256_sub_epi32(d[2 * stride], d[5 * stride]);
+    __m256i tmp3 = _mm256_add_epi32(d[3 * stride], d[4 * stride]);
+    __m256i tmp4 = _mm256_sub_epi32(d[3 * stride], d[4 * stride]);
+
+    // Even part
+    __m256i tmp10 = _mm256_add_epi32(tmp0, tmp3);
+    __m256i tmp13 = _mm256_sub_epi32(tmp0, tmp3);
+    __m256i tmp11 = _mm256_add_epi32(tmp1, tmp2);
+    __m256i tmp12 = _mm256_sub_epi32(tmp1, tmp2);
+
+    d[0 * stride] = dct__descale_avx2(_mm256_slli_epi32(_mm256_add_epi32(tmp10, tmp11), ISLOW_CONST_BITS), shift);
+    d[4 * stride] = dct__descale_avx2(_mm256_slli_epi32(_mm256_sub_epi32(tmp10, tmp11), ISLOW_CONST_BITS), shift);
+
+    __m256i z1 = dct__mul_avx2(_mm256_add_epi32(tmp12, tmp13), ISLOW_FIX_0_541196100);
+    d[2 * stride] = dct__descale_avx2(_mm256_add_epi32(z1, dct__mul_avx2(tmp13, ISLOW_FIX_0_765366865)), shift);
+    d[6 * stride] = dct__descale_avx2(_mm256_sub_epi32(z1, dct__mul_avx2(tmp12, ISLOW_FIX_1_847759065)), shift);
+
+    // Odd part
+    z1 = _mm256_add_epi32(tmp4, tmp7);
+    __m256i z2 = _mm256_add_epi32(tmp5, tmp6);
+    __m256i z3 = _mm256_add_epi32(tmp4, tmp6);
+    __m256i z4 = _mm256_add_epi32(tmp5, tmp7);
+    __m256i z5 = dct__mul_avx2(_mm256_add_epi32(z3, z4), ISLOW_FIX_1_175875602);
+
+    tmp4 = dct__mul_avx2(tmp4, ISLOW_FIX_0_298631336);
+    tmp5 = dct__mul_avx2(tmp5, ISLOW_FIX_2_053119869);
+    tmp6 = dct__mul_avx2(tmp6, ISLOW_FIX_3_072711026);
+    tmp7 = dct__mul_avx2(tmp7, ISLOW_FIX_1_501321110);
+    z1 = dct__mul_avx2(z1, -ISLOW_FIX_0_899976223);
+    z2 = dct__mul_avx2(z2, -ISLOW_FIX_2_562915447);
+    z3 = _mm256_add_epi32(dct__mul_avx2(z3, -ISLOW_FIX_1_961570560), z5);
+    z4 = _mm256_add_epi32(dct__mul_avx2(z4, -ISLOW_FIX_0_390180644), z5);
+
+    d[7 * stride] = dct__descale_avx2(_mm256_add_epi32(tmp4, _mm256_add_epi32(z1, z3)), shift);
+    d[5 * stride] = dct__descale_avx2(_mm256_add_epi32(tmp5, _mm256_add_epi32(z2, z4)), shift);
+    d[3 * stride] = dct__descale_avx2(_mm256_add_epi32(tmp6, _mm256_add_epi32(z2, z3)), shift);
+    d[1 * stride] = dct__descale_avx2(_mm256_add_epi32(tmp7, _mm256_add_epi32(z1, z4)), shift);
+}
+
+DCT_AVX2 static inline void idct__islow_1d_avx2(__m256i *d, size_t stride, int shift) {
+    // Even part
+    __m256i z2 = d[2 * stride];
+    __m256i z3 = d[6 * stride];
+    __m256i z1 = dct__mul_avx2(_mm256_add_epi32(z2, z3), ISLOW_FIX_0_541196100);
+    __m256i tmp2 = _mm256_sub_epi32(z1, dct__mul_avx2(z3, ISLOW_FIX_1_847759065));
+    __m256i tmp3 = _mm256_add_epi32(z1, dct__mul_avx2(z2, ISLOW_FIX_0_765366865));
+
+    z2 = d[0 * stride];
+    z3 = d[4 * stride];
+    __m256i tmp0 = _mm256_slli_epi32(_mm256_add_epi32(z2, z3), ISLOW_CONST_BITS);
+    __m256i tmp1 = _mm256_slli_epi32(_mm256_sub_epi32(z2, z3), ISLOW_CONST_BITS);
+
+    __m256i tmp10 = _mm256_add_epi32(tmp0, tmp3);
+    __m256i tmp13 = _mm256_sub_epi32(tmp0, tmp3);
+    __m256i tmp11 = _mm256_add_epi32(tmp1, tmp2);
+    __m256i tmp12 = _mm256_sub_epi32(tmp1, tmp2);
+
+    // Odd part
+    tmp0 = d[7 * stride];
+    tmp1 = d[5 * stride];
+    tmp2 = d[3 * stride];
+    tmp3 = d[1 * stride];
+
+    z1 = _mm256_add_epi32(tmp0, tmp3);
+    z2 = _mm256_add_epi32(tmp1, tmp2);
+    z3 = _mm256_add_epi32(tmp0, tmp2);
+    __m256i z4 = _mm256_add_epi32(tmp1, tmp3);
+    __m256i z5 = dct__mul_avx2(_mm256_add_epi32(z3, z4), ISLOW_FIX_1_175875602);
+
+    tmp0 = dct__mul_avx2(tmp0, ISLOW_FIX_0_298631336);
+    tmp1 = dct__mul_avx2(tmp1, ISLOW_FIX_2_053119869);
+    tmp2 = dct__mul_avx2(tmp2, ISLOW_FIX_3_072711026);
+    tmp3 = dct__mul_avx2(tmp3, ISLOW_FIX_1_501321110);
+    z1 = dct__mul_avx2(z1, -ISLOW_FIX_0_899976223);
+    z2 = dct__mul_avx2(z2, -ISLOW_FIX_2_562915447);
+    z3 = _mm256_add_epi32(dct__mul_avx2(z3, -ISLOW_FIX_1_961570560), z5);
+    z4 = _mm256_add_epi32(dct__mul_avx2(z4, -ISLOW_FIX_0_390180644), z5);
+
+    tmp0 = _mm256_add_epi32(tmp0, _mm256_add_epi32(z1, z3));
+    tmp1 = _mm256_add_epi32(tmp1, _mm256_add_epi32(z2, z4));
+    tmp2 = _mm256_add_epi32(tmp2, _mm256_add_epi32(z2, z3));
+    tmp3 = _mm256_add_epi32(tmp3, _mm256_add_epi32(z1, z4));
+
+    d[0 * stride] = dct__descale_avx2(_mm256_add_epi32(tmp10, tmp3), shift);
+    d[7 * stride] = dct__descale_avx2(_mm256_sub_epi32(tmp10, tmp3), shift);
+    d[1 * stride] = dct__descale_avx2(_mm256_add_epi32(tmp11, tmp2), shift);
+    d[6 * stride] = dct__descale_avx2(_mm256_sub_epi32(tmp11, tmp2), shift);
+    d[2 * stride] = dct__descale_avx2(_mm256_add_epi32(tmp12, tmp1), shift);
+    d[5 * stride] = dct__descale_avx2(_mm256_sub_epi32(tmp12, tmp1), shift);
+    d[3 * stride] = dct__descale_avx2(_mm256_add_epi32(tmp13, tmp0), shift);
+    d[4 * stride] = dct__descale_avx2(_mm256_sub_epi32(tmp13, tmp0), shift);
+}
+
+DCT_AVX2 static inline void dct__transpose8_epi16(__m128i *r) {
+    __m128i a0 = _mm_unpacklo_epi16(r[0], r[1]);
+    __m128i a1 = _mm_unpackhi_epi16(r[0], r[1]);
+    __m128i a2 = _mm_unpacklo_epi16(r[2], r[3]);
+    __m128i a3 = _mm_unpackhi_epi16(r[2], r[3]);
+    __m128i a4 = _mm_unpacklo_epi16(r[4], r[5]);
+    __m128i a5 = _mm_unpackhi_epi16(r[4], r[5]);
+    __m128i a6 = _mm_unpacklo_epi16(r[6], r[7]);
+    __m128i a7 = _mm_unpackhi_epi16(r[6], r[7]);
+
+    __m128i b0 = _mm_unpacklo_epi32(a0, a2);
+    __m128i b1 = _mm_unpackhi_epi32(a0, a2);
+    __m128i b2 = _mm_unpacklo_epi32(a1, a3);
+    __m128i b3 = _mm_unpackhi_epi32(a1, a3);
+    __m128i b4 = _mm_unpacklo_epi32(a4, a6);
+    __m128i b5 = _mm_unpackhi_epi32(a4, a6);
+    __m128i b6 = _mm_unpacklo_epi32(a5, a7);
+    __m128i b7 = _mm_unpackhi_epi32(a5, a7);
+
+    r[0] = _mm_unpacklo_epi64(b0, b4);
+    r[1] = _mm_unpackhi_epi64(b0, b4);
+    r[2] = _mm_unpacklo_epi64(b1, b5);
+    r[3] = _mm_unpackhi_epi64(b1, b5);
+    r[4] = _mm_unpacklo_epi64(b2, b6);
+    r[5] = _mm_unpackhi_epi64(b2, b6);
+    r[6] = _mm_unpacklo_epi64(b3, b7);
+    r[7] = _mm_unpackhi_epi64(b3, b7);
+}
+
+// Loads element (n1, n2) of 8 blocks, widened to 32 bits, into lane b of
+// v[n1][n2]; block b starts at src + b * block_step and its rows are row_step apart
+DCT_AVX2 static inline void dct__load_batch_avx2(const int16_t *src, size_t row_step, size_t block_step, __m256i v[BLOCK_SIZE][BLOCK_SIZE]) {
     for (size_t n1 = 0; n1 < BLOCK_SIZE; n1++) {
+        const int16_t *row = src + n1 * row_step;
+        __m128i r[8] = {
+            _mm_loadu_si128((const __m128i *)(row + 0 * block_step)),
+            _mm_loadu_si128((const __m128i *)(row + 1 * block_step)),
+            _mm_loadu_si128((const __m128i *)(row + 2 * block_step)),
+            _mm_loadu_si128((const __m128i *)(row + 3 * block_step)),
+            _mm_loadu_si128((const __m128i *)(row + 4 * block_step)),
+            _mm_loadu_si128((const __m128i *)(row + 5 * block_step)),
+            _mm_loadu_si128((const __m128i *)(row + 6 * block_step)),
+            _mm_loadu_si128((const __m128i *)(row + 7 * block_step)),
+        };
+        dct__transpose8_epi16(r);
         for (size_t n2 = 0; n2 < BLOCK_SIZE; n2++) {
-            double sum = 0;
-            for (size_t k1 = 0; k1 < BLOCK_SIZE; k1++) {
-                for (size_t k2 = 0; k2 < BLOCK_SIZE; k2++) {
-                    sum += alpha(k1) * alpha(k2) * X[k1][k2] *
-                        cos(M_PI / BLOCK_SIZE * (n1 + 0.5) * k1) *
-                        cos(M_PI / BLOCK_SIZE * (n2 + 0.5) * k2);
-                }
-            }
+            v[n1][n2] = _mm256_cvtepi16_epi32(r[n2]);
+        }
+    }
+}
+
+// Narrows with signed saturation, like dct__saturate16
+DCT_AVX2 static inline __m128i dct__pack_epi32_avx2(__m256i v) {
+    v = _mm256_packs_epi32(v, v);
+    return _mm256_castsi256_si128(_mm256_permute4x64_epi64(v, 0x08));
+}
+
+DCT_AVX2 static inline void dct__store_batch_avx2(__m256i v[BLOCK_SIZE][BLOCK_SIZE], int16_t *dst, size_t row_step, size_t block_step) {
+    for (size_t n1 = 0; n1 < BLOCK_SIZE; n1++) {
+        int16_t *row = dst + n1 * row_step;
+        __m128i r[8] = {
+            dct__pack_epi32_avx2(v[n1][0]), dct__pack_epi32_avx2(v[n1][1]),
+            dct__pack_epi32_avx2(v[n1][2]), dct__pack_epi32_avx2(v[n1][3]),
+            dct__pack_epi32_avx2(v[n1][4]), dct__pack_epi32_avx2(v[n1][5]),
+            dct__pack_epi32_avx2(v[n1][6]), dct__pack_epi32_avx2(v[n1][7]),
+        };
+        dct__transpose8_epi16(r);
+        _mm_storeu_si128((__m128i *)(row + 0 * block_step), r[0]);
+        _mm_storeu_si128((__m128i *)(row + 1 * block_step), r[1]);
+        _mm_storeu_si128((__m128i *)(row + 2 * block_step), r[2]);
+        _mm_storeu_si128((__m128i *)(row + 3 * block_step), r[3]);
+        _mm_storeu_si128((__m128i *)(row + 4 * block_step), r[4]);
+        _mm_storeu_si128((__m128i *)(row + 5 * block_step), r[5]);
+        _mm_storeu_si128((__m128i *)(row + 6 * block_step), r[6]);
+        _mm_storeu_si128((__m128i *)(row + 7 * block_step), r[7]);
+    }
+}
+DCT_AVX2 static void dct__int_batch_avx2(const int16_t *x, unsigned long stride, int16_t X[DCT_INT_BATCH][BLOCK_SIZE][BLOCK_SIZE]) {
+    __m256i v[BLOCK_SIZE][BLOCK_SIZE];
+    dct__load_batch_avx2(x, stride, BLOCK_SIZE, v);
+
+    for (size_t i = 0; i < BLOCK_SIZE; i++) {
+        dct__islow_1d_avx2(v[i], 1, ISLOW_FORWARD_SHIFT1);
+    }
+    for (size_t j = 0; j < BLOCK_SIZE; j++) {
+        dct__islow_1d_avx2(&v[0][j], BLOCK_SIZE, ISLOW_FORWARD_SHIFT2);
+    }
+
+    dct__store_batch_avx2(v, &X[0][0][0], BLOCK_SIZE, BLOCK_SIZE * BLOCK_SIZE);
+}
+
+DCT_AVX2 static void idct__int_batch_avx2(const int16_t X[DCT_INT_BATCH][BLOCK_SIZE][BLOCK_SIZE], int16_t *x, unsigned long stride) {
+    __m256i v[BLOCK_SIZE][BLOCK_SIZE];
+    dct__load_batch_avx2(&X[0][0][0], BLOCK_SIZE, BLOCK_SIZE * BLOCK_SIZE, v);
+
+    for (size_t j = 0; j < BLOCK_SIZE; j++) {
+        idct__islow_1d_avx2(&v[0][j], BLOCK_SIZE, ISLOW_INVERSE_SHIFT1);
+    }
+    for (size_t i = 0; i < BLOCK_SIZE; i++) {
+        idct__islow_1d_avx2(v[i], 1, ISLOW_INVERSE_SHIFT2);
+    }
+
+    dct__store_batch_avx2(v, x, stride, BLOCK_SIZE);
+}
+#endif
+
+void dct2d_int_batch(const int16_t *x, unsigned long stride, int16_t X[DCT_INT_BATCH][BLOCK_SIZE][BLOCK_SIZE]) {
+#if defined(DCT_X86_DISPATCH)
+    if (__builtin_cpu_supports("avx2")) {
+        dct__int_batch_avx2(x, stride, X);
+        return;
+    }
+#endif
+
+    for (size_t b = 0; b < DCT_INT_BATCH; b++) {
+        int16_t block[BLOCK_SIZE][BLOCK_SIZE];
+        for (size_t i = 0; i < BLOCK_SIZE; i++) {
+            memcpy(block[i], x + i * stride + b * BLOCK_SIZE, sizeof(int16_t) * BLOCK_SIZE);
+        }
+        dct2d_int(block, X[b]);
+    }
+}
+
+void idct2d_int_batch(const int16_t X[DCT_INT_BATCH][BLOCK_SIZE][BLOCK_SIZE], int16_t *x, unsigned long stride) {
+#if defined(DCT_X86_DISPATCH)
+    if (__builtin_cpu_supports("avx2")) {
+        idct__int_batch_avx2(X, x, stride);
+        return;
+    }
+#endif
 
-            x[n1][n2] = sum;
+    for (size_t b = 0; b < DCT_INT_BATCH; b++) {
+        int16_t block[BLOCK_SIZE][BLOCK_SIZE];
+        idct2d_int(X[b], block);
+        for (size_t i = 0; i < BLOCK_SIZE; i++) {
+            memcpy(x + i * stride + b * BLOCK_SIZE, block[i], sizeof(int16_t) * BLOCK_SIZE);
         }
     }
 }
+
+// Direct n x n integer DCTs for the block sizes without a fast factorization
+// here. DCT_INT_COS_N[k][n] is the orthonormal DCT-II basis in ISLOW_CONST_BITS
+// fixed point. Each size gets its own kernel with constant bounds, so the
+// compiler can unroll and vectorize the sums.
+static const int32_t DCT_INT_COS_4[4][4] = {
+    { 4096,  4096,  4096,  4096},
+    { 5352,  2217, -2217, -5352},
+    { 4096, -4096, -4096,  4096},
+    { 2217, -5352,  5352, -2217},
+};
+
+static const int32_t DCT_INT_COS_16[16][16] = {
+    { 2048,  2048,  2048,  2048,  2048,  2048,  2048,  2048,  2048,  2048,  2048,  2048,  2048,  2048,  2048,  2048},
+    { 2882,  2772,  2554,  2239,  1837,  1365,   841,   284,  -284,  -841, -1365, -1837, -2239, -2554, -2772, -2882},
+    { 2841,  2408,  1609,   565,  -565, -1609, -2408, -2841, -2841, -2408, -1609,  -565,   565,  1609,  2408,  2841},
+    { 2772,  1837,   284, -1365, -2554, -2882, -2239,  -841,   841,  2239,  2882,  2554,  1365,  -284, -1837, -2772},
+    { 2676,  1108, -1108, -2676, -2676, -1108,  1108,  2676,  2676,  1108, -1108, -2676, -2676, -1108,  1108,  2676},
+    { 2554,   284, -2239, -2772,  -841,  1837,  2882,  1365, -1365, -2882, -1837,   841,  2772,  2239,  -284, -2554},
+    { 2408,  -565, -2841, -1609,  1609,  2841,   565, -2408, -2408,   565,  2841,  1609, -1609, -2841,  -565,  2408},
+    { 2239, -1365, -2772,   284,  2882,   841, -2554, -1837,  1837,  2554,  -841, -2882,  -284,  2772,  1365, -2239},
+    { 2048, -2048, -2048,  2048,  2048, -2048, -2048,  2048,  2048, -2048, -2048,  2048,  2048, -2048, -2048,  2048},
+    { 1837, -2554,  -841,  2882,  -284, -2772,  1365,  2239, -2239, -1365,  2772,   284, -2882,   841,  2554, -1837},
+    { 1609, -2841,   565,  2408, -2408,  -565,  2841, -1609, -1609,  2841,  -565, -2408,  2408,   565, -2841,  1609},
+    { 1365, -2882,  1837,   841, -2772,  2239,   284, -2554,  2554,  -284, -2239,  2772,  -841, -1837,  2882, -1365},
+    { 1108, -2676,  2676, -1108, -1108,  2676, -2676,  1108,  1108, -2676,  2676, -1108, -1108,  2676, -2676,  1108},
+    {  841, -2239,  2882, -2554,  1365,   284, -1837,  2772, -2772,  1837,  -284, -1365,  2554, -2882,  2239,  -841},
+    {  565, -1609,  2408, -2841,  2841, -2408,  1609,  -565,  -565,  1609, -2408,  2841, -2841,  2408, -1609,   565},
+    {  284,  -841,  1365, -1837,  2239, -2554,  2772, -2882,  2882, -2772,  2554, -2239,  1837, -1365,   841,  -284},
+};
+
+// The rows go through the basis with ISLOW_PASS1_BITS of extra precision
+// kept, the columns are descaled to 8x the orthonormal result like islow
+#define DCT_INT_FORWARD_SHIFT2 (ISLOW_CONST_BITS + ISLOW_PASS1_BITS - 3)
+#define DCT_INT_INVERSE_SHIFT2 (ISLOW_CONST_BITS + ISLOW_PASS1_BITS)
+
+#define DCT__DEFINE_INT_KERNELS(N)                                                                   \
+    static void dct__int_##N(const int16_t *x, size_t stride, int16_t *X) {                          \
+        int32_t tmp[N][N];                                                                           \
+        for (size_t i = 0; i < N; i++) {                                                             \
+            for (size_t k = 0; k < N; k++) {                                                         \
+                int32_t acc = 0;                                                                     \
+                for (size_t n = 0; n < N; n++) {                                                     \
+                    acc += x[i * stride + n] * DCT_INT_COS_##N[k][n];                                \
+                }                                                                                    \
+                tmp[i][k] = dct__descale(acc, ISLOW_FORWARD_SHIFT1);                                 \
+            }                                                                                        \
+        }                                                                                            \
+        for (size_t k1 = 0; k1 < N; k1++) {                                                          \
+            for (size_t k2 = 0; k2 < N; k2++) {                                                      \
+                int32_t acc = 0;                                                                     \
+                for (size_t i = 0; i < N; i++) {                                                     \
+                    acc += tmp[i][k2] * DCT_INT_COS_##N[k1][i];                                      \
+                }                                                                                    \
+                X[k1 * N + k2] = dct__saturate16(dct__descale(acc, DCT_INT_FORWARD_SHIFT2));         \
+            }                                                                                        \
+        }                                                                                            \
+    }                                                                                                \
+                                                                                                     \
+    static void idct__int_##N(const int16_t *X, int16_t *x, size_t stride) {                         \
+        int32_t tmp[N][N];                                                                           \
+        for (size_t n1 = 0; n1 < N; n1++) {                                                          \
+            for (size_t k2 = 0; k2 < N; k2++) {                                                      \
+                int32_t acc = 0;                                                                     \
+                for (size_t k1 = 0; k1 < N; k1++) {                                                  \
+                    acc += X[k1 * N + k2] * DCT_INT_COS_##N[k1][n1];                                 \
+                }                                                                                    \
+                tmp[n1][k2] = dct__descale(acc, ISLOW_INVERSE_SHIFT1);                               \
+            }                                                                                        \
+        }                                                                                            \
+        for (size_t n1 = 0; n1 < N; n1++) {                                                          \
+            for (size_t n2 = 0; n2 < N; n2++) {                                                      \
+                int32_t acc = 0;                                                                     \
+                for (size_t k2 = 0; k2 < N; k2++) {                                                  \
+                    acc += tmp[n1][k2] * DCT_INT_COS_##N[k2][n2];                                    \
+                }                                                                                    \
+                x[n1 * stride + n2] = dct__saturate16(dct__descale(acc, DCT_INT_INVERSE_SHIFT2));    \
+            }                                                                                        \
+        }                                                                                            \
+    }
+
+DCT__DEFINE_INT_KERNELS(4)
+DCT__DEFINE_INT_KERNELS(16)
+
+void dct2d_int_n(unsigned long n, const int16_t *x, unsigned long stride, int16_t *X) {
+    switch (n) {
+    case 4:
+        dct__int_4(x, stride, X);
+        break;
+    case BLOCK_SIZE: {
+        int16_t block[BLOCK_SIZE][BLOCK_SIZE];
+        for (size_t i = 0; i < BLOCK_SIZE; i++) {
+            memcpy(block[i], x + i * stride, sizeof(block[i]));
+        }
+        dct2d_int(block, (int16_t (*)[BLOCK_SIZE])X);
+        break;
+    }
+    case 16:
+        dct__int_16(x, stride, X);
+        break;
+    }
+}
+
+void idct2d_int_n(unsigned long n, const int16_t *X, int16_t *x, unsigned long stride) {
+    switch (n) {
+    case 4:
+        idct__int_4(X, x, stride);
+        break;
+    case BLOCK_SIZE: {
+        int16_t block[BLOCK_SIZE][BLOCK_SIZE];
+        idct2d_int((const int16_t (*)[BLOCK_SIZE])X, block);
+        for (size_t i = 0; i < BLOCK_SIZE; i++) {
+            memcpy(x + i * stride, block[i], sizeof(block[i]));
+        }
+        break;
+    }
+    case 16:
+        idct__int_16(X, x, stride);
+        break;
+    }
+}
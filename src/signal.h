@@ -2,6 +2,7 @@
 #define SIGNAL_H
 
 #include <complex.h>
+#include <stdint.h>
 
 void fft_simple(const complex double *x, unsigned long n, complex double *x_out);
 void ifft_simple(const complex double *x, unsigned long n, complex double *x_out);
@@ -17,4 +18,26 @@ void ifft2d(const complex double *x, unsigned long width, unsigned long height,
 void dct2d(const double x[BLOCK_SIZE][BLOCK_SIZE], double X[BLOCK_SIZE][BLOCK_SIZE]);
 void idct2d(const double X[BLOCK_SIZE][BLOCK_SIZE], double x[BLOCK_SIZE][BLOCK_SIZE]);
 
+// Fixed-point DCT after libjpeg's islow. Samples are level shifted to
+// [-128, 127]; dct2d_int outputs coefficients scaled up by 8 like jpeg_fdct_islow
+// and idct2d_int takes unscaled coefficients. Outputs saturate to int16.
+void dct2d_int(const int16_t x[BLOCK_SIZE][BLOCK_SIZE], int16_t X[BLOCK_SIZE][BLOCK_SIZE]);
+void idct2d_int(const int16_t X[BLOCK_SIZE][BLOCK_SIZE], int16_t x[BLOCK_SIZE][BLOCK_SIZE]);
+
+// Transforms DCT_INT_BATCH horizontally adjacent blocks of a row-major plane at
+// once (one block per 32-bit AVX2 lane when available); `stride` is the plane
+// row length
+#define DCT_INT_BATCH 8
+
+void dct2d_int_batch(const int16_t *x, unsigned long stride, int16_t X[DCT_INT_BATCH][BLOCK_SIZE][BLOCK_SIZE]);
+void idct2d_int_batch(const int16_t X[DCT_INT_BATCH][BLOCK_SIZE][BLOCK_SIZE], int16_t *x, unsigned long stride);
+
+// Same as dct2d_int/idct2d_int for n x n blocks, n one of 4, BLOCK_SIZE or
+// DCT_MAX_BLOCK_SIZE, read from / written to a plane with row length `stride`.
+// The coefficients are n * n row-major values with the same scaling.
+#define DCT_MAX_BLOCK_SIZE 16
+
+void dct2d_int_n(unsigned long n, const int16_t *x, unsigned long stride, int16_t *X);
+void idct2d_int_n(unsigned long n, const int16_t *X, int16_t *x, unsigned long stride);
+
 #endif // SIGNAL_H
@@ -4,8 +4,12 @@
 #include <string.h>
 #include <complex.h>
 #include <math.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include "aids.h"
+#include "image.h"
+#include "jpeg.h"
 #include "signal.h"
 #include "steg.h"
 
@@ -14,85 +18,1196 @@ static const char *steg__g_failure_reason;
 #define BYTE_SIZE 8
 
 static bool steg__validate_compression(int compression) {
-    bool is_in_range = (compression > 0 && compression <= BYTE_SIZE);
-    bool is_power_of_two = (compression & (compression - 1)) == 0;
+    return compression > 0 && compression <= BYTE_SIZE;
+}
+
+// Payload bytes that fit in the cover
+static size_t steg__lsb_capacity(size_t bytes_length, size_t compression) {
+    return bytes_length / BYTE_SIZE * compression + bytes_length % BYTE_SIZE * compression / BYTE_SIZE;
+}
+
+// The embedded stream is a bitstream, most significant bit first, laid over
+// the low compression bits of consecutive cover bytes. When compression does
+// not divide 8 a sample straddles two payload bytes, so the runs move the
+// bits through a 64-bit register that is refilled (or flushed) a word at a
+// time and peel compression bits off per sample.
+typedef struct {
+    const uint8_t *data;
+    size_t length;
+    size_t pos;
+    uint64_t reg; // Next bits, most significant first
+    size_t bits;  // Bits of reg that are valid
+} Steg_Bit_Reader;
+
+typedef struct {
+    uint8_t *data;
+    size_t length;
+    size_t pos;
+    uint64_t reg;
+    size_t bits;
+} Steg_Bit_Writer;
+
+static uint64_t steg__load_be64(const uint8_t *p) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < 8; i++) {
+        value = (value << BYTE_SIZE) | p[i];
+    }
+    return value;
+}
+
+static void steg__store_be64(uint8_t *p, uint64_t value) {
+    for (size_t i = 0; i < 8; i++) {
+        p[i] = (uint8_t)(value >> (56 - BYTE_SIZE * i));
+    }
+}
+
+// Tops reg up to at least 56 bits, or to the end of the data. Whole words are
+// ORed in past the valid bits, the next refill ORs the same bits back there.
+static void steg__bits_refill(Steg_Bit_Reader *reader) {
+    if (reader->pos + 8 <= reader->length) {
+        reader->reg |= steg__load_be64(reader->data + reader->pos) >> reader->bits;
+        reader->pos += (63 - reader->bits) >> 3;
+        reader->bits |= 56;
+        return;
+    }
+    while (reader->bits <= 56 && reader->pos < reader->length) {
+        reader->reg |= (uint64_t)reader->data[reader->pos++] << (56 - reader->bits);
+        reader->bits += BYTE_SIZE;
+    }
+}
+
+// Takes count (1 to 8) bits, which the caller knows are there
+static unsigned steg__bits_read(Steg_Bit_Reader *reader, size_t count) {
+    if (reader->bits < count) {
+        steg__bits_refill(reader);
+    }
+    unsigned value = (unsigned)(reader->reg >> (64 - count));
+    reader->reg <<= count;
+    reader->bits -= count;
+    return value;
+}
+
+// Writes out the whole bytes of reg, leaving less than 8 bits
+static void steg__bits_flush(Steg_Bit_Writer *writer) {
+    size_t count = writer->bits >> 3;
+    if (writer->pos + 8 <= writer->length) {
+        // The bytes past count are rewritten by the next flush
+        steg__store_be64(writer->data + writer->pos, writer->reg);
+    } else {
+        for (size_t i = 0; i < count; i++) {
+            writer->data[writer->pos + i] = (uint8_t)(writer->reg >> (56 - BYTE_SIZE * i));
+        }
+    }
+    writer->pos += count;
+    writer->reg = count < 8 ? writer->reg << (BYTE_SIZE * count) : 0;
+    writer->bits -= BYTE_SIZE * count;
+}
+
+static void steg__bits_write(Steg_Bit_Writer *writer, unsigned value, size_t count) {
+    writer->reg |= (uint64_t)value << (64 - writer->bits - count);
+    writer->bits += count;
+}
+
+// Hides count bytes starting at byte offset of the embedded stream
+static void steg__hide_lsb_run(uint8_t *bytes, size_t offset, const uint8_t *payload, size_t count, size_t compression) {
+    if (count == 0) {
+        return;
+    }
+
+    Steg_Bit_Reader reader = {.data = payload, .length = count};
+    size_t k = compression;
+    size_t bit = offset * BYTE_SIZE;
+    size_t remaining = count * BYTE_SIZE;
+    uint8_t *sample = bytes + bit / k;
+
+    // A sample shared with the bytes before the run keeps its leading bits
+    size_t phase = bit % k;
+    if (phase != 0) {
+        size_t n = k - phase;
+        uint8_t mask = (uint8_t)((1u << n) - 1);
+        *sample = (*sample & ~mask) | steg__bits_read(&reader, n);
+        sample += 1;
+        remaining -= n;
+    }
+
+    uint8_t mask = (uint8_t)((1u << k) - 1);
+    while (remaining >= k) {
+        steg__bits_refill(&reader);
+        size_t n = reader.bits / k;
+        if (n > remaining / k) {
+            n = remaining / k;
+        }
+        uint64_t reg = reader.reg;
+        for (size_t i = 0; i < n; i++) {
+            sample[i] = (sample[i] & ~mask) | (uint8_t)(reg >> (64 - k));
+            reg <<= k;
+        }
+        reader.reg = reg;
+        reader.bits -= n * k;
+        sample += n;
+        remaining -= n * k;
+    }
+
+    // And one shared with the bytes after it keeps its trailing bits
+    if (remaining > 0) {
+        size_t shift = k - remaining;
+        uint8_t tail = (uint8_t)(((1u << remaining) - 1) << shift);
+        *sample = (*sample & ~tail) | (uint8_t)(steg__bits_read(&reader, remaining) << shift);
+    }
+}
+
+static void steg__show_lsb_run(const uint8_t *bytes, size_t offset, uint8_t *message, size_t count, size_t compression) {
+    if (count == 0) {
+        return;
+    }
+
+    Steg_Bit_Writer writer = {.data = message, .length = count};
+    size_t k = compression;
+    size_t bit = offset * BYTE_SIZE;
+    size_t remaining = count * BYTE_SIZE;
+    const uint8_t *sample = bytes + bit / k;
+
+    size_t phase = bit % k;
+    if (phase != 0) {
+        size_t n = k - phase;
+        steg__bits_write(&writer, *sample & ((1u << n) - 1), n);
+        sample += 1;
+        remaining -= n;
+    }
+
+    uint8_t mask = (uint8_t)((1u << k) - 1);
+    while (remaining >= k) {
+        steg__bits_flush(&writer);
+        size_t n = (64 - writer.bits) / k;
+        if (n > remaining / k) {
+            n = remaining / k;
+        }
+        uint64_t reg = writer.reg;
+        size_t shift = 64 - writer.bits;
+        for (size_t i = 0; i < n; i++) {
+            shift -= k;
+            reg |= (uint64_t)(sample[i] & mask) << shift;
+        }
+        writer.reg = reg;
+        writer.bits += n * k;
+        sample += n;
+        remaining -= n * k;
+    }
+
+    if (remaining > 0) {
+        steg__bits_write(&writer, (*sample & mask) >> (k - remaining), remaining);
+    }
+    steg__bits_flush(&writer);
+}
+
+STEGDEF Steg_Result steg_hide_lsb(uint8_t *bytes, size_t bytes_length,
+                                  const uint8_t *payload, size_t payload_length,
+                                  int compression) {
+    Steg_Result result = STEG_OK;
+
+    if (!steg__validate_compression(compression)) {
+        steg__g_failure_reason = "Invalid compression value";
+        return_defer(STEG_ERR);
+    }
+
+    if (payload_length > steg__lsb_capacity(bytes_length, compression)) {
+        steg__g_failure_reason = "Data is too big for the cover image";
+        return_defer(STEG_ERR);
+    }
+
+    steg__hide_lsb_run(bytes, 0, payload, payload_length, compression);
+
+defer:
+    return result;
+}
+
+STEGDEF Steg_Result steg_show_lsb(const uint8_t *bytes, size_t bytes_length,
+                                  uint8_t *message, size_t message_length,
+                                  int compression) {
+    Steg_Result result = STEG_OK;
+
+    if (!steg__validate_compression(compression)) {
+        steg__g_failure_reason = "Invalid compression value";
+        return_defer(STEG_ERR);
+    }
+
+    if (message_length > steg__lsb_capacity(bytes_length, compression)) {
+        steg__g_failure_reason = "Data is too big for the cover image";
+        return_defer(STEG_ERR);
+    }
+
+    steg__show_lsb_run(bytes, 0, message, message_length, compression);
+
+defer:
+    return result;
+}
+
+#define STEG_LENGTH_BITS 56
+
+STEGDEF void steg_put_length(uint8_t *out, size_t length, uint8_t flags) {
+    uint64_t prefix = ((uint64_t)length & ((1ull << STEG_LENGTH_BITS) - 1)) | ((uint64_t)flags << STEG_LENGTH_BITS);
+    for (size_t i = 0; i < STEG_LENGTH_SIZE; i++) {
+        out[i] = (uint8_t)(prefix >> (BYTE_SIZE * i));
+    }
+}
+
+// Lengths that do not fit a size_t come back as SIZE_MAX, which fails every
+// capacity check
+STEGDEF size_t steg_get_length(const uint8_t *in, uint8_t *flags) {
+    uint64_t prefix = 0;
+    for (size_t i = 0; i < STEG_LENGTH_SIZE; i++) {
+        prefix |= (uint64_t)in[i] << (BYTE_SIZE * i);
+    }
+    if (flags != NULL) {
+        *flags = (uint8_t)(prefix >> STEG_LENGTH_BITS);
+    }
+
+    uint64_t length = prefix & ((1ull << STEG_LENGTH_BITS) - 1);
+#if SIZE_MAX < UINT64_MAX
+    if (length > SIZE_MAX) {
+        return SIZE_MAX;
+    }
+#endif
+    return (size_t)length;
+}
+
+static void steg__put_u32(uint8_t *out, uint32_t value) {
+    for (size_t i = 0; i < STEG_CRC_SIZE; i++) {
+        out[i] = (uint8_t)(value >> (BYTE_SIZE * i));
+    }
+}
+
+static uint32_t steg__get_u32(const uint8_t *in) {
+    uint32_t value = 0;
+    for (size_t i = 0; i < STEG_CRC_SIZE; i++) {
+        value |= (uint32_t)in[i] << (BYTE_SIZE * i);
+    }
+    return value;
+}
+
+// Integrity framing: the body a method embeds is the CRC32C of its own length
+// header, the payload, and the CRC32C of everything before it (length header
+// included). The first one can be checked as soon as the header and four more
+// bytes are out, which is what lets the extractors give up early.
+static uint32_t steg__integrity_header_crc(size_t body_length) {
+    uint8_t header[STEG_LENGTH_SIZE];
+    steg_put_length(header, body_length, 0);
+    return crc32c(0, header, STEG_LENGTH_SIZE);
+}
+
+STEGDEF int steg_integrity_header_ok(size_t body_length, const uint8_t *body) {
+    if (body_length < 2 * STEG_CRC_SIZE) {
+        return false;
+    }
+
+    return steg__get_u32(body) == steg__integrity_header_crc(body_length);
+}
+
+STEGDEF Steg_Result steg_integrity_wrap(const uint8_t *payload, size_t payload_length,
+                                        uint8_t **body, size_t *body_length) {
+    Steg_Result result = STEG_OK;
+
+    *body_length = payload_length + 2 * STEG_CRC_SIZE;
+    *body = AIDS_REALLOC(NULL, *body_length * sizeof(uint8_t));
+    if (*body == NULL) {
+        steg__g_failure_reason = aids_failure_reason();
+        return_defer(STEG_ERR);
+    }
+
+    steg__put_u32(*body, steg__integrity_header_crc(*body_length));
+    memcpy(*body + STEG_CRC_SIZE, payload, payload_length);
+
+    uint8_t header[STEG_LENGTH_SIZE];
+    steg_put_length(header, *body_length, 0);
+    uint32_t crc = crc32c(0, header, STEG_LENGTH_SIZE);
+    crc = crc32c(crc, *body, STEG_CRC_SIZE + payload_length);
+    steg__put_u32(*body + STEG_CRC_SIZE + payload_length, crc);
+
+defer:
+    return result;
+}
+
+STEGDEF Steg_Result steg_integrity_unwrap(uint8_t *body, size_t *body_length) {
+    Steg_Result result = STEG_OK;
+
+    if (!steg_integrity_header_ok(*body_length, body)) {
+        steg__g_failure_reason = "Integrity check failed: no payload in the cover";
+        return_defer(STEG_ERR);
+    }
+
+    size_t payload_length = *body_length - 2 * STEG_CRC_SIZE;
+    uint8_t header[STEG_LENGTH_SIZE];
+    steg_put_length(header, *body_length, 0);
+    uint32_t crc = crc32c(0, header, STEG_LENGTH_SIZE);
+    crc = crc32c(crc, body, STEG_CRC_SIZE + payload_length);
+    if (crc != steg__get_u32(body + STEG_CRC_SIZE + payload_length)) {
+        steg__g_failure_reason = "Integrity check failed: the payload is corrupted";
+        return_defer(STEG_ERR);
+    }
+
+    memmove(body, body + STEG_CRC_SIZE, payload_length);
+    body[payload_length] = 0;
+    *body_length = payload_length;
+
+defer:
+    return result;
+}
+
+// Code bytes handled per chunk by the ECC variants of LSB, small enough for
+// the data, the code and the cover bytes they land in to stay in cache
+#define STEG_LSB_CHUNK 4096
+
+// Whole frames per chunk, at least min_frames
+static size_t steg__lsb_chunk_frames(size_t frame_code, size_t min_frames) {
+    size_t frames = STEG_LSB_CHUNK / frame_code;
+    return frames > min_frames ? frames : min_frames;
+}
+
+// Stream positions count data bytes from the start of the length prefix. With
+// ECC the frames covering the prefix are kept in head and encoded by
+// steg_lsb_end. The others go through data a chunk of frames at a time:
+// encoded and hidden once the chunk is full when writing, extracted and
+// decoded when the reader gets to it.
+struct Steg_Lsb_Session {
+    uint8_t *bytes;
+    size_t compression;
+    uint8_t flags;    // Writing: STEG_PAYLOAD_* flags of the length prefix
+    size_t capacity;  // Data bytes the cover holds
+    size_t position;
+    size_t remaining; // Reading: message bytes left
+
+    Ecc_Codec *codec;
+    size_t frame_data;
+    size_t frame_code;
+    size_t head_frames;
+    size_t chunk_frames;
+    size_t frames;        // Reading: frames holding the message
+    size_t window;        // Stream offset of data, on a frame boundary
+    size_t window_length; // Reading: bytes of data decoded
+    size_t uncorrected;   // Reading: units that could not be corrected
+    uint8_t *head;        // head_frames * frame_data
+    uint8_t *data;        // chunk_frames * frame_data
+    uint8_t *code;        // chunk_frames * frame_code
+};
+
+static Steg_Result steg__lsb_session_new(const uint8_t *bytes, size_t bytes_length, const Steg_Lsb_Params *params,
+                                         Steg_Lsb_Session **session) {
+    Steg_Result result = STEG_OK;
+    Steg_Lsb_Session *s = NULL;
+
+    if (!steg__validate_compression(params->compression)) {
+        steg__g_failure_reason = "Invalid compression value";
+        return_defer(STEG_ERR);
+    }
+
+    s = AIDS_REALLOC(NULL, sizeof(Steg_Lsb_Session));
+    if (s == NULL) {
+        steg__g_failure_reason = aids_failure_reason();
+        return_defer(STEG_ERR);
+    }
+    memset(s, 0, sizeof(Steg_Lsb_Session));
+    s->bytes = (uint8_t *)bytes;
+    s->compression = params->compression;
+    s->flags = params->flags;
+    s->capacity = steg__lsb_capacity(bytes_length, s->compression);
+
+    if (params->ecc != NULL) {
+        if (ecc_codec_new(params->ecc, &s->codec) != ECC_OK) {
+            steg__g_failure_reason = "Invalid error correction options";
+            return_defer(STEG_ERR);
+        }
+        s->frame_data = ecc_frame_data(s->codec);
+        s->frame_code = ecc_frame_code(s->codec);
+        s->head_frames = (STEG_LENGTH_SIZE + s->frame_data - 1) / s->frame_data;
+        s->chunk_frames = steg__lsb_chunk_frames(s->frame_code, s->head_frames);
+        s->frames = s->head_frames;
+        s->window = s->head_frames * s->frame_data;
+        s->capacity = s->capacity / s->frame_code * s->frame_data;
+        s->head = AIDS_REALLOC(NULL, s->head_frames * s->frame_data * sizeof(uint8_t));
+        s->data = AIDS_REALLOC(NULL, s->chunk_frames * s->frame_data * sizeof(uint8_t));
+        s->code = AIDS_REALLOC(NULL, s->chunk_frames * s->frame_code * sizeof(uint8_t));
+        if (s->head == NULL || s->data == NULL || s->code == NULL) {
+            steg__g_failure_reason = aids_failure_reason();
+            return_defer(STEG_ERR);
+        }
+    }
+
+    if (s->capacity < STEG_LENGTH_SIZE) {
+        steg__g_failure_reason = "The image is too small to carry a payload";
+        return_defer(STEG_ERR);
+    }
+
+defer:
+    if (result != STEG_OK && s != NULL) {
+        steg_lsb_close(s);
+        s = NULL;
+    }
+    *session = s;
+    return result;
+}
+
+STEGDEF void steg_lsb_close(Steg_Lsb_Session *session) {
+    if (session == NULL) {
+        return;
+    }
+    if (session->head != NULL) {
+        AIDS_FREE(session->head);
+    }
+    if (session->data != NULL) {
+        AIDS_FREE(session->data);
+    }
+    if (session->code != NULL) {
+        AIDS_FREE(session->code);
+    }
+    ecc_codec_free(session->codec);
+    AIDS_FREE(session);
+}
+
+// Encodes count stream bytes starting at frame, the last frame zero padded,
+// and hides them
+static void steg__lsb_session_flush(Steg_Lsb_Session *session, size_t frame, const uint8_t *data, size_t count) {
+    size_t frames = (count + session->frame_data - 1) / session->frame_data;
+    ecc_encode_frames(session->codec, data, count, session->code);
+    steg__hide_lsb_run(session->bytes, frame * session->frame_code, session->code, frames * session->frame_code,
+                       session->compression);
+}
+
+// Appends to the stream, the caller checks the capacity
+static void steg__lsb_session_push(Steg_Lsb_Session *session, const uint8_t *data, size_t length) {
+    if (session->codec == NULL) {
+        steg__hide_lsb_run(session->bytes, session->position, data, length, session->compression);
+        session->position += length;
+        return;
+    }
+
+    size_t head_end = session->head_frames * session->frame_data;
+    size_t chunk = session->chunk_frames * session->frame_data;
+    while (length > 0) {
+        size_t take = 0;
+        if (session->position < head_end) {
+            take = head_end - session->position < length ? head_end - session->position : length;
+            memcpy(session->head + session->position, data, take);
+        } else {
+            size_t offset = session->position - session->window;
+            take = chunk - offset < length ? chunk - offset : length;
+            memcpy(session->data + offset, data, take);
+            if (offset + take == chunk) {
+                steg__lsb_session_flush(session, session->window / session->frame_data, session->data, chunk);
+                session->window += chunk;
+            }
+        }
+        session->position += take;
+        data += take;
+        length -= take;
+    }
+}
+
+STEGDEF Steg_Result steg_lsb_begin(uint8_t *bytes, size_t bytes_length, const Steg_Lsb_Params *params,
+                                   Steg_Lsb_Session **session) {
+    Steg_Result result = STEG_OK;
+
+    if (steg__lsb_session_new(bytes, bytes_length, params, session) != STEG_OK) {
+        return_defer(STEG_ERR);
+    }
+
+    // Room for the length prefix, written by steg_lsb_end
+    uint8_t placeholder[STEG_LENGTH_SIZE] = {0};
+    steg__lsb_session_push(*session, placeholder, STEG_LENGTH_SIZE);
+
+defer:
+    return result;
+}
+
+STEGDEF Steg_Result steg_lsb_write(Steg_Lsb_Session *session, const uint8_t *data, size_t length) {
+    Steg_Result result = STEG_OK;
+
+    if (length > session->capacity - session->position) {
+        steg__g_failure_reason = "Data is too big for the cover image";
+        return_defer(STEG_ERR);
+    }
+
+    steg__lsb_session_push(session, data, length);
+
+defer:
+    return result;
+}
+
+STEGDEF Steg_Result steg_lsb_end(Steg_Lsb_Session *session) {
+    uint8_t header[STEG_LENGTH_SIZE];
+    steg_put_length(header, session->position - STEG_LENGTH_SIZE, session->flags);
+    if (session->codec == NULL) {
+        steg__hide_lsb_run(session->bytes, 0, header, STEG_LENGTH_SIZE, session->compression);
+    } else {
+        if (session->position > session->window) {
+            steg__lsb_session_flush(session, session->window / session->frame_data, session->data,
+                                    session->position - session->window);
+        }
+
+        size_t head_end = session->head_frames * session->frame_data;
+        memcpy(session->head, header, STEG_LENGTH_SIZE);
+        steg__lsb_session_flush(session, 0, session->head,
+                                session->position < head_end ? session->position : head_end);
+    }
+
+    steg_lsb_close(session);
+    return STEG_OK;
+}
+
+// Extracts and decodes the chunk of frames starting at frame, up to the last
+// frame of the message
+static void steg__lsb_session_load(Steg_Lsb_Session *session, size_t frame) {
+    size_t n = session->frames - frame < session->chunk_frames ? session->frames - frame : session->chunk_frames;
+    steg__show_lsb_run(session->bytes, frame * session->frame_code, session->code, n * session->frame_code,
+                       session->compression);
+    session->uncorrected += ecc_decode_frames(session->codec, session->code, n, session->data);
+    session->window = frame * session->frame_data;
+    session->window_length = n * session->frame_data;
+}
+
+// Takes the next length bytes of the stream, the caller checks the capacity
+static void steg__lsb_session_pull(Steg_Lsb_Session *session, uint8_t *data, size_t length) {
+    if (session->codec == NULL) {
+        steg__show_lsb_run(session->bytes, session->position, data, length, session->compression);
+        session->position += length;
+        return;
+    }
+
+    while (length > 0) {
+        if (session->position < session->window || session->position >= session->window + session->window_length) {
+            steg__lsb_session_load(session, session->position / session->frame_data);
+        }
+        size_t offset = session->position - session->window;
+        size_t take = session->window_length - offset < length ? session->window_length - offset : length;
+        memcpy(data, session->data + offset, take);
+        session->position += take;
+        data += take;
+        length -= take;
+    }
+}
+
+STEGDEF Steg_Result steg_lsb_open(const uint8_t *bytes, size_t bytes_length, const Steg_Lsb_Params *params,
+                                  Steg_Lsb_Session **session, size_t *message_length, uint8_t *flags) {
+    Steg_Result result = STEG_OK;
+
+    if (steg__lsb_session_new(bytes, bytes_length, params, session) != STEG_OK) {
+        return_defer(STEG_ERR);
+    }
+
+    // Only the frames of the prefix are decoded until it says how many follow
+    uint8_t header[STEG_LENGTH_SIZE];
+    steg__lsb_session_pull(*session, header, STEG_LENGTH_SIZE);
+    *message_length = steg_get_length(header, flags);
+    if (*message_length > (*session)->capacity - STEG_LENGTH_SIZE) {
+        steg__g_failure_reason = "Message length exceeds the maximum allowed size";
+        return_defer(STEG_ERR);
+    }
+    (*session)->remaining = *message_length;
+    if ((*session)->codec != NULL) {
+        (*session)->frames = (STEG_LENGTH_SIZE + *message_length + (*session)->frame_data - 1) / (*session)->frame_data;
+    }
+
+defer:
+    if (result != STEG_OK && *session != NULL) {
+        steg_lsb_close(*session);
+        *session = NULL;
+    }
+    return result;
+}
+
+STEGDEF Steg_Result steg_lsb_read(Steg_Lsb_Session *session, uint8_t *data, size_t capacity, size_t *length) {
+    *length = session->remaining < capacity ? session->remaining : capacity;
+    steg__lsb_session_pull(session, data, *length);
+    session->remaining -= *length;
+    return STEG_OK;
+}
+
+STEGDEF size_t steg_lsb_uncorrected(const Steg_Lsb_Session *session) {
+    return session->uncorrected;
+}
+
+STEGDEF Steg_Result steg_hide_lsb_ecc(uint8_t *bytes, size_t bytes_length,
+                                      const uint8_t *payload, size_t payload_length,
+                                      int compression, const Ecc_Options *ecc, uint8_t flags) {
+    Steg_Result result = STEG_OK;
+    Steg_Lsb_Session *session = NULL;
+
+    Steg_Lsb_Params params = {.compression = compression, .ecc = ecc, .flags = flags};
+    if (steg_lsb_begin(bytes, bytes_length, &params, &session) != STEG_OK) {
+        return_defer(STEG_ERR);
+    }
+    if (steg_lsb_write(session, payload, payload_length) != STEG_OK) {
+        steg_lsb_close(session);
+        return_defer(STEG_ERR);
+    }
+    steg_lsb_end(session);
+
+defer:
+    return result;
+}
+
+STEGDEF Steg_Result steg_show_lsb_ecc(const uint8_t *bytes, size_t bytes_length,
+                                      uint8_t **message, size_t *message_length,
+                                      int compression, const Ecc_Options *ecc, int integrity,
+                                      uint8_t *flags, size_t *uncorrected) {
+    Steg_Result result = STEG_OK;
+    Steg_Lsb_Session *session = NULL;
+    *message = NULL;
+
+    Steg_Lsb_Params params = {.compression = compression, .ecc = ecc};
+    if (steg_lsb_open(bytes, bytes_length, &params, &session, message_length, flags) != STEG_OK) {
+        return_defer(STEG_ERR);
+    }
+
+    *message = AIDS_REALLOC(NULL, (*message_length + 1) * sizeof(unsigned char));
+    if (*message == NULL) {
+        steg__g_failure_reason = aids_failure_reason();
+        return_defer(STEG_ERR);
+    }
+    (*message)[*message_length] = 0;
+
+    // The header CRC is checked as soon as it is out
+    size_t read = 0;
+    if (integrity) {
+        steg_lsb_read(session, *message, STEG_CRC_SIZE, &read);
+        if (!steg_integrity_header_ok(*message_length, *message)) {
+            steg__g_failure_reason = "Integrity check failed: no payload in the cover";
+            return_defer(STEG_ERR);
+        }
+    }
+    size_t rest = 0;
+    steg_lsb_read(session, *message + read, *message_length - read, &rest);
+
+    if (uncorrected != NULL) {
+        *uncorrected = steg_lsb_uncorrected(session);
+    }
+
+defer:
+    steg_lsb_close(session);
+    if (result != STEG_OK && *message != NULL) {
+        AIDS_FREE(*message);
+        *message = NULL;
+    }
+    return result;
+}
+
+#define STEG_CONTAINER_MAGIC_SIZE 4
+#define STEG_VARINT_MAX 10
+// Magic, version, flags, five varints and the header CRC
+#define STEG_CONTAINER_MAX_HEADER (STEG_CONTAINER_MAGIC_SIZE + 2 + 5 * STEG_VARINT_MAX + STEG_CRC_SIZE)
+#define STEG_CONTAINER_FLAGS (STEG_CONTAINER_ECC | STEG_CONTAINER_COMPRESSED | STEG_CONTAINER_CRC)
+#define STEG_CONTAINER_MAX_THREADS 64
+// Smallest share of embedded bytes worth a thread
+#define STEG_CONTAINER_MIN_BYTES_PER_THREAD (256 * 1024)
+
+static size_t steg__varint_put(uint8_t *out, uint64_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+    return n;
+}
+
+static bool steg__varint_get(const uint8_t *in, size_t length, size_t *pos, uint64_t *value) {
+    *value = 0;
+    for (size_t shift = 0; shift < 64 && *pos < length; shift += 7) {
+        uint8_t byte = in[(*pos)++];
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static size_t steg__container_header(const Steg_Container *container, uint8_t *header) {
+    size_t n = 0;
+    memcpy(header, STEG_CONTAINER_MAGIC, STEG_CONTAINER_MAGIC_SIZE);
+    n += STEG_CONTAINER_MAGIC_SIZE;
+    header[n++] = container->version;
+    header[n++] = container->flags;
+    n += steg__varint_put(header + n, container->payload_length);
+    n += steg__varint_put(header + n, container->chunk_size);
+    if (container->flags & STEG_CONTAINER_ECC) {
+        n += steg__varint_put(header + n, container->ecc.code);
+        n += steg__varint_put(header + n, container->ecc.parity);
+        n += steg__varint_put(header + n, container->ecc.depth);
+    }
+    steg__put_u32(header + n, crc32c(0, header, n));
+    return n + STEG_CRC_SIZE;
+}
+
+static size_t steg__container_chunk_length(const Steg_Container *container, size_t index) {
+    size_t begin = index * container->chunk_size;
+    size_t rest = container->payload_length - begin;
+    return rest < container->chunk_size ? rest : container->chunk_size;
+}
+
+// End of the last chunk in the embedded stream
+static size_t steg__container_end(const Steg_Container *container) {
+    size_t count = container->chunk_count;
+    if (count == 0) {
+        return container->data_offset;
+    }
+    size_t last = steg__container_chunk_length(container, count - 1);
+    size_t last_frames = (last + container->frame_data - 1) / container->frame_data;
+    return container->data_offset + (count - 1) * container->chunk_code + last_frames * container->frame_code;
+}
+
+// Fills in the derived sizes, and checks that everything fits in capacity
+// embedded bytes
+static Steg_Result steg__container_layout(Steg_Container *container, size_t capacity) {
+    Steg_Result result = STEG_OK;
+    Ecc_Codec *codec = NULL;
+
+    if (container->chunk_size == 0 || container->payload_length > capacity || container->chunk_size > capacity) {
+        steg__g_failure_reason = "Data is too big for the cover image";
+        return_defer(STEG_ERR);
+    }
+
+    container->frame_data = 1;
+    container->frame_code = 1;
+    if (container->flags & STEG_CONTAINER_ECC) {
+        if (ecc_codec_new(&container->ecc, &codec) != ECC_OK) {
+            steg__g_failure_reason = "Invalid error correction options";
+            return_defer(STEG_ERR);
+        }
+        container->frame_data = ecc_frame_data(codec);
+        container->frame_code = ecc_frame_code(codec);
+    }
+
+    size_t count = (container->payload_length + container->chunk_size - 1) / container->chunk_size;
+    size_t frames = (container->chunk_size + container->frame_data - 1) / container->frame_data;
+    container->chunk_count = count;
+    container->chunk_code = frames * container->frame_code;
+    container->data_offset = container->header_length +
+                             ((container->flags & STEG_CONTAINER_CRC) ? count * STEG_CRC_SIZE : 0);
+    if (steg__container_end(container) > capacity) {
+        steg__g_failure_reason = "Data is too big for the cover image";
+        return_defer(STEG_ERR);
+    }
+
+defer:
+    ecc_codec_free(codec);
+    return result;
+}
+
+// A share of the chunks for one worker, which brings its own codec and
+// scratch buffers since those are not shared between threads
+typedef struct {
+    uint8_t *bytes;
+    size_t compression;
+    const Steg_Container *container;
+    const uint8_t *payload; // Hiding: the whole payload
+    uint8_t *message;       // Showing: the whole message
+
+    size_t chunk_begin;
+    size_t chunk_end;
+    Steg_Result result;  // STEG_ERR if the worker could not set itself up
+    size_t corrupted;    // Chunks that failed their CRC
+    size_t uncorrected;  // ECC units that could not be corrected
+} Steg_Container_Job;
+
+typedef struct {
+    Ecc_Codec *codec;
+    uint8_t *code;
+    uint8_t *tail;
+} Steg_Container_Scratch;
+
+static Steg_Result steg__container_scratch(const Steg_Container *container, Steg_Container_Scratch *scratch) {
+    Steg_Result result = STEG_OK;
+    memset(scratch, 0, sizeof(*scratch));
+
+    if (!(container->flags & STEG_CONTAINER_ECC)) {
+        return_defer(STEG_OK);
+    }
+    if (ecc_codec_new(&container->ecc, &scratch->codec) != ECC_OK) {
+        steg__g_failure_reason = "Invalid error correction options";
+        return_defer(STEG_ERR);
+    }
+    scratch->code = AIDS_REALLOC(NULL, container->chunk_code * sizeof(uint8_t));
+    scratch->tail = AIDS_REALLOC(NULL, container->frame_data * sizeof(uint8_t));
+    if (scratch->code == NULL || scratch->tail == NULL) {
+        steg__g_failure_reason = aids_failure_reason();
+        return_defer(STEG_ERR);
+    }
+
+defer:
+    return result;
+}
+
+static void steg__container_scratch_free(Steg_Container_Scratch *scratch) {
+    if (scratch->code != NULL) {
+        AIDS_FREE(scratch->code);
+    }
+    if (scratch->tail != NULL) {
+        AIDS_FREE(scratch->tail);
+    }
+    ecc_codec_free(scratch->codec);
+}
 
-    return is_in_range && is_power_of_two;
+static void steg__container_hide_chunk(uint8_t *bytes, size_t compression, const Steg_Container *container,
+                                       Steg_Container_Scratch *scratch, size_t index, const uint8_t *data) {
+    size_t length = steg__container_chunk_length(container, index);
+    size_t offset = container->data_offset + index * container->chunk_code;
+    if (scratch->codec != NULL) {
+        size_t frames = (length + container->frame_data - 1) / container->frame_data;
+        ecc_encode_frames(scratch->codec, data, length, scratch->code);
+        steg__hide_lsb_run(bytes, offset, scratch->code, frames * container->frame_code, compression);
+    } else {
+        steg__hide_lsb_run(bytes, offset, data, length, compression);
+    }
+
+    if (container->flags & STEG_CONTAINER_CRC) {
+        uint8_t crc[STEG_CRC_SIZE];
+        steg__put_u32(crc, crc32c(0, data, length));
+        steg__hide_lsb_run(bytes, container->header_length + index * STEG_CRC_SIZE, crc, STEG_CRC_SIZE, compression);
+    }
 }
 
-static void steg__util_hide_lsbn(unsigned char *ptr, unsigned char byte, size_t count) {
-    for (size_t i = 0; i < BYTE_SIZE / count; i++) {
-        unsigned char ptr_byte = ptr[i];
-        for (size_t j = 0; j < count; j++) {
-            unsigned char mask = 0b00000001 << (count - j - 1);
-            ptr_byte = ptr_byte & ~mask;
+// Returns whether the chunk passed its CRC (always true without one), and adds
+// the ECC units it could not correct to uncorrected
+static bool steg__container_show_chunk(const uint8_t *bytes, size_t compression, const Steg_Container *container,
+                                       Steg_Container_Scratch *scratch, size_t index, uint8_t *data,
+                                       size_t *uncorrected) {
+    size_t length = steg__container_chunk_length(container, index);
+    size_t offset = container->data_offset + index * container->chunk_code;
+    if (scratch->codec != NULL) {
+        // Whole frames decode in place, the padded last one goes through tail
+        // so that it does not spill into the next chunk
+        size_t whole = length / container->frame_data;
+        size_t rest = length - whole * container->frame_data;
+        size_t frames = whole + (rest > 0);
+        steg__show_lsb_run(bytes, offset, scratch->code, frames * container->frame_code, compression);
+        *uncorrected += ecc_decode_frames(scratch->codec, scratch->code, whole, data);
+        if (rest > 0) {
+            *uncorrected += ecc_decode_frames(scratch->codec, scratch->code + whole * container->frame_code, 1,
+                                              scratch->tail);
+            memcpy(data + whole * container->frame_data, scratch->tail, rest);
         }
-        for (size_t j = 0; j < count; j++) {
-            unsigned char bit = ((byte >> (BYTE_SIZE - i * count - j - 1)) & 0b00000001);
-            ptr_byte = ptr_byte | (bit << (count - j - 1));
+    } else {
+        steg__show_lsb_run(bytes, offset, data, length, compression);
+    }
+
+    if (!(container->flags & STEG_CONTAINER_CRC)) {
+        return true;
+    }
+    uint8_t crc[STEG_CRC_SIZE];
+    steg__show_lsb_run(bytes, container->header_length + index * STEG_CRC_SIZE, crc, STEG_CRC_SIZE, compression);
+    return steg__get_u32(crc) == crc32c(0, data, length);
+}
+
+static void *steg__container_hide_worker(void *arg) {
+    Steg_Container_Job *job = arg;
+    Steg_Container_Scratch scratch;
+    job->result = steg__container_scratch(job->container, &scratch);
+    if (job->result == STEG_OK) {
+        for (size_t i = job->chunk_begin; i < job->chunk_end; i++) {
+            steg__container_hide_chunk(job->bytes, job->compression, job->container, &scratch, i,
+                                       job->payload + i * job->container->chunk_size);
         }
-        ptr[i] = ptr_byte;
     }
+    steg__container_scratch_free(&scratch);
+    return NULL;
 }
 
-static void steg__util_show_lsbn(const unsigned char *ptr, unsigned char *byte, size_t count) {
-    for (size_t i = 0; i < BYTE_SIZE / count; i++) {
-        unsigned char ptr_byte = ptr[i];
-        for (size_t j = 0; j < count; j++) {
-            unsigned char mask = 0b00000001 << (count - j - 1);
-            unsigned char bit = ((ptr_byte & mask) >> (count - j - 1)) & 0b00000001;
-            *byte |= (bit << (BYTE_SIZE - i * count - j - 1));
+static void *steg__container_show_worker(void *arg) {
+    Steg_Container_Job *job = arg;
+    Steg_Container_Scratch scratch;
+    job->result = steg__container_scratch(job->container, &scratch);
+    if (job->result == STEG_OK) {
+        for (size_t i = job->chunk_begin; i < job->chunk_end; i++) {
+            if (!steg__container_show_chunk(job->bytes, job->compression, job->container, &scratch, i,
+                                            job->message + i * job->container->chunk_size, &job->uncorrected)) {
+                job->corrupted += 1;
+            }
         }
     }
+    steg__container_scratch_free(&scratch);
+    return NULL;
 }
 
-STEGDEF Steg_Result steg_hide_lsb(uint8_t *bytes, size_t bytes_length,
-                                  const uint8_t *payload, size_t payload_length,
-                                  int compression) {
+// Splits the chunks over worker threads, they touch disjoint message bytes
+// and, when compression divides 8, disjoint cover bytes. Otherwise the sample
+// at the end of one share may carry the first bits of the next, so with seams
+// the first chunk of every share and the last chunk (its CRC sits right
+// before chunk 0) are left to the calling thread once the others are done.
+static Steg_Result steg__container_parallel(Steg_Container_Job *job, void *(*worker)(void *), bool seams) {
+    size_t count = job->container->chunk_count;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t num_threads = cpus > 0 ? (size_t)cpus : 1;
+    if (num_threads > STEG_CONTAINER_MAX_THREADS) {
+        num_threads = STEG_CONTAINER_MAX_THREADS;
+    }
+    size_t max_useful = count * job->container->chunk_code / STEG_CONTAINER_MIN_BYTES_PER_THREAD;
+    if (max_useful > count) {
+        max_useful = count;
+    }
+    if (num_threads > max_useful) {
+        num_threads = max_useful > 0 ? max_useful : 1;
+    }
+    size_t share = (count + num_threads - 1) / num_threads;
+
+    Steg_Container_Job jobs[STEG_CONTAINER_MAX_THREADS];
+    pthread_t threads[STEG_CONTAINER_MAX_THREADS];
+    bool started[STEG_CONTAINER_MAX_THREADS] = {0};
+    for (size_t t = 0; t < num_threads; t++) {
+        jobs[t] = *job;
+        jobs[t].corrupted = 0;
+        jobs[t].uncorrected = 0;
+        jobs[t].chunk_begin = t * share < count ? t * share : count;
+        jobs[t].chunk_end = (t + 1) * share < count ? (t + 1) * share : count;
+    }
+    seams = seams && num_threads > 1;
+    size_t seam_begin[STEG_CONTAINER_MAX_THREADS];
+    if (seams) {
+        for (size_t t = 0; t < num_threads; t++) {
+            seam_begin[t] = jobs[t].chunk_begin;
+            if (t > 0 && jobs[t].chunk_begin < jobs[t].chunk_end) {
+                jobs[t].chunk_begin += 1;
+            }
+            if (jobs[t].chunk_end == count && jobs[t].chunk_begin < jobs[t].chunk_end) {
+                jobs[t].chunk_end -= 1;
+            }
+        }
+    }
+
+    // The calling thread takes the first share
+    for (size_t t = 1; t < num_threads; t++) {
+        started[t] = pthread_create(&threads[t], NULL, worker, &jobs[t]) == 0;
+    }
+    worker(&jobs[0]);
+    for (size_t t = 1; t < num_threads; t++) {
+        if (started[t]) {
+            pthread_join(threads[t], NULL);
+        } else {
+            worker(&jobs[t]);
+        }
+    }
+
+    job->result = STEG_OK;
+    job->corrupted = 0;
+    job->uncorrected = 0;
+    if (seams) {
+        for (size_t t = 1; t <= num_threads; t++) {
+            Steg_Container_Job seam = *job;
+            seam.corrupted = 0;
+            seam.uncorrected = 0;
+            seam.chunk_begin = t < num_threads ? seam_begin[t] : count - 1;
+            seam.chunk_end = seam.chunk_begin < count ? seam.chunk_begin + 1 : count;
+            worker(&seam);
+            if (seam.result != STEG_OK) {
+                job->result = STEG_ERR;
+            }
+            job->corrupted += seam.corrupted;
+            job->uncorrected += seam.uncorrected;
+        }
+    }
+    for (size_t t = 0; t < num_threads; t++) {
+        if (jobs[t].result != STEG_OK) {
+            job->result = STEG_ERR;
+        }
+        job->corrupted += jobs[t].corrupted;
+        job->uncorrected += jobs[t].uncorrected;
+    }
+    return job->result;
+}
+
+STEGDEF Steg_Result steg_hide_lsb_container(uint8_t *bytes, size_t bytes_length,
+                                            const uint8_t *payload, size_t payload_length,
+                                            int compression, size_t chunk_size, uint8_t flags,
+                                            const Ecc_Options *ecc) {
     Steg_Result result = STEG_OK;
 
     if (!steg__validate_compression(compression)) {
         steg__g_failure_reason = "Invalid compression value";
         return_defer(STEG_ERR);
     }
+    if ((flags & ~STEG_CONTAINER_FLAGS) != 0 || ((flags & STEG_CONTAINER_ECC) && ecc == NULL)) {
+        steg__g_failure_reason = "Invalid container flags";
+        return_defer(STEG_ERR);
+    }
 
-    size_t byte_stride = BYTE_SIZE / compression;
-    if (payload_length * byte_stride > bytes_length) {
-        steg__g_failure_reason = "Data is too big for the cover image";
+    Steg_Container container = {
+        .version = STEG_CONTAINER_VERSION,
+        .flags = flags,
+        .payload_length = payload_length,
+        .chunk_size = chunk_size,
+    };
+    if (flags & STEG_CONTAINER_ECC) {
+        container.ecc = *ecc;
+    }
+
+    uint8_t header[STEG_CONTAINER_MAX_HEADER];
+    container.header_length = steg__container_header(&container, header);
+    if (steg__container_layout(&container, steg__lsb_capacity(bytes_length, compression)) != STEG_OK) {
         return_defer(STEG_ERR);
     }
 
-    for (size_t i = 0; i < payload_length; i++) {
-        steg__util_hide_lsbn(bytes + i * byte_stride, payload[i], compression);
+    steg__hide_lsb_run(bytes, 0, header, container.header_length, compression);
+    Steg_Container_Job job = {
+        .bytes = bytes,
+        .compression = compression,
+        .container = &container,
+        .payload = payload,
+    };
+    if (steg__container_parallel(&job, steg__container_hide_worker, BYTE_SIZE % compression != 0) != STEG_OK) {
+        return_defer(STEG_ERR);
     }
 
 defer:
     return result;
 }
 
-STEGDEF Steg_Result steg_show_lsb(const uint8_t *bytes, size_t bytes_length,
-                                  uint8_t *message, size_t message_length,
-                                  int compression) {
+STEGDEF int steg_lsb_has_container(const uint8_t *bytes, size_t bytes_length, int compression) {
+    if (!steg__validate_compression(compression) ||
+        steg__lsb_capacity(bytes_length, compression) < STEG_CONTAINER_MAGIC_SIZE) {
+        return false;
+    }
+
+    uint8_t magic[STEG_CONTAINER_MAGIC_SIZE];
+    steg__show_lsb_run(bytes, 0, magic, STEG_CONTAINER_MAGIC_SIZE, compression);
+    return memcmp(magic, STEG_CONTAINER_MAGIC, STEG_CONTAINER_MAGIC_SIZE) == 0;
+}
+
+STEGDEF Steg_Result steg_show_lsb_container(const uint8_t *bytes, size_t bytes_length,
+                                            int compression, Steg_Container *container) {
+    Steg_Result result = STEG_OK;
+    memset(container, 0, sizeof(*container));
+
+    if (!steg_lsb_has_container(bytes, bytes_length, compression)) {
+        steg__g_failure_reason = "No container in the cover";
+        return_defer(STEG_ERR);
+    }
+
+    size_t capacity = steg__lsb_capacity(bytes_length, compression);
+    uint8_t header[STEG_CONTAINER_MAX_HEADER];
+    size_t length = capacity < STEG_CONTAINER_MAX_HEADER ? capacity : STEG_CONTAINER_MAX_HEADER;
+    steg__show_lsb_run(bytes, 0, header, length, compression);
+
+    size_t pos = STEG_CONTAINER_MAGIC_SIZE;
+    uint64_t payload_length = 0, chunk_size = 0, code = 0, parity = 0, depth = 0;
+    bool ok = pos + 2 <= length;
+    if (ok) {
+        container->version = header[pos++];
+        container->flags = header[pos++];
+        ok = steg__varint_get(header, length, &pos, &payload_length) &&
+             steg__varint_get(header, length, &pos, &chunk_size);
+    }
+    if (ok && (container->flags & STEG_CONTAINER_ECC)) {
+        ok = steg__varint_get(header, length, &pos, &code) &&
+             steg__varint_get(header, length, &pos, &parity) &&
+             steg__varint_get(header, length, &pos, &depth);
+    }
+    if (!ok || pos + STEG_CRC_SIZE > length || steg__get_u32(header + pos) != crc32c(0, header, pos)) {
+        steg__g_failure_reason = "Integrity check failed: the container header is corrupted";
+        return_defer(STEG_ERR);
+    }
+    if (container->version != STEG_CONTAINER_VERSION) {
+        steg__g_failure_reason = "Unsupported container version";
+        return_defer(STEG_ERR);
+    }
+    if ((container->flags & ~STEG_CONTAINER_FLAGS) != 0 || payload_length > SIZE_MAX || chunk_size > SIZE_MAX ||
+        code > ECC_RS || parity > RS_MAX_PARITY || depth > ECC_MAX_DEPTH) {
+        steg__g_failure_reason = "Invalid container header";
+        return_defer(STEG_ERR);
+    }
+
+    container->payload_length = payload_length;
+    container->chunk_size = chunk_size;
+    container->ecc.code = (Ecc_Code)code;
+    container->ecc.parity = parity;
+    container->ecc.depth = depth;
+    container->header_length = pos + STEG_CRC_SIZE;
+    if (steg__container_layout(container, capacity) != STEG_OK) {
+        return_defer(STEG_ERR);
+    }
+
+defer:
+    return result;
+}
+
+STEGDEF Steg_Result steg_show_lsb_chunk(const uint8_t *bytes, size_t bytes_length, int compression,
+                                        const Steg_Container *container, size_t index,
+                                        uint8_t *chunk, size_t *chunk_length, size_t *uncorrected) {
     Steg_Result result = STEG_OK;
+    Steg_Container_Scratch scratch = {0};
+    size_t failures = 0;
 
     if (!steg__validate_compression(compression)) {
         steg__g_failure_reason = "Invalid compression value";
         return_defer(STEG_ERR);
     }
+    if (steg__container_end(container) > steg__lsb_capacity(bytes_length, compression)) {
+        steg__g_failure_reason = "The container does not fit in the cover image";
+        return_defer(STEG_ERR);
+    }
+    if (index >= container->chunk_count) {
+        steg__g_failure_reason = "Chunk index out of range";
+        return_defer(STEG_ERR);
+    }
+    if (steg__container_scratch(container, &scratch) != STEG_OK) {
+        return_defer(STEG_ERR);
+    }
 
-    if (message_length * (BYTE_SIZE / compression) > bytes_length) {
-        steg__g_failure_reason = "Data is too big for the cover image";
+    *chunk_length = steg__container_chunk_length(container, index);
+    if (!steg__container_show_chunk(bytes, compression, container, &scratch, index, chunk, &failures)) {
+        steg__g_failure_reason = "Integrity check failed: the chunk is corrupted";
         return_defer(STEG_ERR);
     }
+    if (uncorrected != NULL) {
+        *uncorrected = failures;
+    }
+
+defer:
+    steg__container_scratch_free(&scratch);
+    return result;
+}
+
+STEGDEF Steg_Result steg_show_lsb_chunks(const uint8_t *bytes, size_t bytes_length, int compression,
+                                         const Steg_Container *container, uint8_t **message, size_t *uncorrected) {
+    Steg_Result result = STEG_OK;
+    *message = NULL;
 
-    size_t byte_stride = BYTE_SIZE / compression;
+    if (!steg__validate_compression(compression)) {
+        steg__g_failure_reason = "Invalid compression value";
+        return_defer(STEG_ERR);
+    }
+    if (steg__container_end(container) > steg__lsb_capacity(bytes_length, compression)) {
+        steg__g_failure_reason = "The container does not fit in the cover image";
+        return_defer(STEG_ERR);
+    }
 
-    memset(message, 0, message_length * sizeof(unsigned char));
-    for (size_t i = 0; i < message_length; i++) {
-        steg__util_show_lsbn(bytes + i * byte_stride, message + i, compression);
+    *message = AIDS_REALLOC(NULL, (container->payload_length + 1) * sizeof(uint8_t));
+    if (*message == NULL) {
+        steg__g_failure_reason = aids_failure_reason();
+        return_defer(STEG_ERR);
+    }
+    (*message)[container->payload_length] = 0;
+
+    Steg_Container_Job job = {
+        .bytes = (uint8_t *)bytes,
+        .compression = compression,
+        .container = container,
+        .message = *message,
+    };
+    if (steg__container_parallel(&job, steg__container_show_worker, false) != STEG_OK) {
+        return_defer(STEG_ERR);
+    }
+    if (job.corrupted > 0) {
+        steg__g_failure_reason = "Integrity check failed: some chunks are corrupted";
+        return_defer(STEG_ERR);
+    }
+    if (uncorrected != NULL) {
+        *uncorrected = job.uncorrected;
     }
 
 defer:
+    if (result != STEG_OK && *message != NULL) {
+        AIDS_FREE(*message);
+        *message = NULL;
+    }
     return result;
 }
 
@@ -175,6 +1290,7 @@ STEGDEF Steg_Result steg_hide_fft(uint8_t *bytes, size_t width, size_t height, s
     complex double *fft_c = NULL;
     complex double *tmp = NULL;
     double *y = NULL;
+    Image_Planes planes = {0};
 
     Steg_Result result = STEG_OK;
 
@@ -192,15 +1308,28 @@ STEGDEF Steg_Result steg_hide_fft(uint8_t *bytes, size_t width, size_t height, s
         return_defer(STEG_ERR);
     }
 
+    // Normalize the image to [0, 1] range
+    if (image_planes_alloc(&planes, width, height, num_chan) != IMAGE_OK) {
+        steg__g_failure_reason = "Could not allocate the image planes";
+        return_defer(STEG_ERR);
+    }
+    image_planes_from_bytes(&planes, bytes);
+
     for (size_t c = 0; c < num_chan; c++) {
-        // Normalize the image to [0, 1] range
+        // Cover channel c carries payload channel c; a single channel payload is
+        // replicated in every cover channel and extra cover channels are left as is
+        size_t payload_c = payload_chan == 1 ? 0 : c;
+        if (payload_c >= payload_chan) {
+            continue;
+        }
+
         fft_c = AIDS_REALLOC(NULL, sizeof(complex double) * width * height);
         if (fft_c == NULL) {
             steg__g_failure_reason = aids_failure_reason();
             return_defer(STEG_ERR);
         }
         for (size_t i = 0; i < width * height; i++) {
-            fft_c[i] = (double)bytes[i * num_chan + c] / 255.0 + 0.0*I;
+            fft_c[i] = planes.planes[c][i] + 0.0*I;
         }
 
         // Perform FFT on the image data
@@ -229,7 +1358,7 @@ STEGDEF Steg_Result steg_hide_fft(uint8_t *bytes, size_t width, size_t height, s
                 size_t index = row * payload_width + col;
 
                 // Normalize the payload value to [0, 1] range
-                double payload_value = (double)payload[index * payload_chan + 0] / 255.0;
+                double payload_value = (double)payload[index * payload_chan + payload_c] / 255.0;
 
                 size_t t_row = margin_y + row;
                 size_t t_col = margin_x + col;
@@ -251,292 +1380,1132 @@ STEGDEF Steg_Result steg_hide_fft(uint8_t *bytes, size_t width, size_t height, s
         memcpy(fft_c, tmp, sizeof(complex double) * width * height);
         AIDS_FREE(tmp); tmp = NULL;
 
-        // Normalize the modified image data back to [0, 255] range
         for (size_t i = 0; i < width * height; i++) {
-            bytes[i * 3 + c] = fmin(fmax(creal(fft_c[i]) * 255.0, 0), 255);
+            planes.planes[c][i] = creal(fft_c[i]);
+        }
+
+        AIDS_FREE(fft_c); fft_c = NULL;
+        AIDS_FREE(tmp); tmp = NULL;
+        AIDS_FREE(y); y = NULL;
+    }
+
+    // Normalize the modified image data back to [0, 255] range
+    image_planes_to_bytes(&planes, bytes);
+
+defer:
+    if (fft_c != NULL) {
+        AIDS_FREE(fft_c);
+    }
+    if (tmp != NULL) {
+        AIDS_FREE(tmp);
+    }
+    if (y != NULL) {
+        AIDS_FREE(y);
+    }
+    image_planes_free(&planes);
+
+    return result;
+}
+
+STEGDEF Steg_Result steg_show_fft(const uint8_t *og_bytes, const uint8_t *bytes,
+                                  size_t width, size_t height, size_t num_chan, uint8_t **message) {
+    complex double *fft_c = NULL;
+    complex double *fft_ogc = NULL;
+    complex double *tmp = NULL;
+    double *y = NULL;
+    Image_Planes planes = {0};
+    Image_Planes og_planes = {0};
+
+    Steg_Result result = STEG_OK;
+
+    // Validate input dimensions
+    if ((width & (width - 1)) != 0 || (height & (height - 1)) != 0) {
+        steg__g_failure_reason = "The input data is not a power of 2 shape.";
+        return_defer(STEG_ERR);
+    }
+
+    *message = AIDS_REALLOC(NULL, (width * height * num_chan) * sizeof(unsigned char));
+    if (*message == NULL) {
+        steg__g_failure_reason = aids_failure_reason();
+        return_defer(STEG_ERR);
+    }
+
+    // Normalize the modified image and the original image to [0, 1] range
+    if (image_planes_alloc(&planes, width, height, num_chan) != IMAGE_OK ||
+        image_planes_alloc(&og_planes, width, height, num_chan) != IMAGE_OK) {
+        steg__g_failure_reason = "Could not allocate the image planes";
+        return_defer(STEG_ERR);
+    }
+    image_planes_from_bytes(&planes, bytes);
+    image_planes_from_bytes(&og_planes, og_bytes);
+
+    for (size_t c = 0; c < num_chan; c++) {
+        fft_c = AIDS_REALLOC(NULL, sizeof(complex double) * width * height);
+        if (fft_c == NULL) {
+            steg__g_failure_reason = aids_failure_reason();
+            return_defer(STEG_ERR);
+        }
+        fft_ogc = AIDS_REALLOC(NULL, sizeof(complex double) * width * height);
+        if (fft_ogc == NULL) {
+            steg__g_failure_reason = aids_failure_reason();
+            return_defer(STEG_ERR);
+        }
+        for (size_t i = 0; i < width * height; i++) {
+            fft_c[i] = planes.planes[c][i] + 0.0*I;
+            fft_ogc[i] = og_planes.planes[c][i] + 0.0*I;
+        }
+
+        // Perform FFT on the modified image data
+        tmp = AIDS_REALLOC(NULL, sizeof(complex double) * width * height);
+        if (tmp == NULL) {
+            steg__g_failure_reason = aids_failure_reason();
+            return_defer(STEG_ERR);
+        }
+        fft2d(fft_c, width, height, tmp);
+        memcpy(fft_c, tmp, sizeof(complex double) * width * height);
+        AIDS_FREE(tmp); tmp = NULL;
+
+        // Perform FFT on the original image data
+        tmp = AIDS_REALLOC(NULL, sizeof(complex double) * width * height);
+        if (tmp == NULL) {
+            steg__g_failure_reason = aids_failure_reason();
+            return_defer(STEG_ERR);
+        }
+        fft2d(fft_ogc, width, height, tmp);
+        memcpy(fft_ogc, tmp, sizeof(complex double) * width * height);
+        AIDS_FREE(tmp); tmp = NULL;
+
+        // Get the difference between the FFT coefficients of the modified image and the original image
+        for (size_t i = 0; i < width * height; i++) {
+            fft_c[i] = fft_c[i] - fft_ogc[i];
         }
 
+        // Centralize the FFT coefficients to [0, 1] range and extract the payload
+        double low, high;
+        y = AIDS_REALLOC(NULL, sizeof(double) * width * height);
+        steg__centralize(fft_c, width, height, y, &low, &high);
+
+        // The stego plane is no longer needed, reuse it for the payload channel
+        memcpy(planes.planes[c], y, sizeof(double) * width * height);
+        AIDS_FREE(y); y = NULL;
+
         AIDS_FREE(fft_c); fft_c = NULL;
+        AIDS_FREE(fft_ogc); fft_ogc = NULL;
         AIDS_FREE(tmp); tmp = NULL;
         AIDS_FREE(y); y = NULL;
     }
 
+    image_planes_to_bytes(&planes, *message);
+
 defer:
     if (fft_c != NULL) {
         AIDS_FREE(fft_c);
     }
+    if (fft_ogc != NULL) {
+        AIDS_FREE(fft_ogc);
+    }
     if (tmp != NULL) {
         AIDS_FREE(tmp);
     }
     if (y != NULL) {
         AIDS_FREE(y);
     }
+    image_planes_free(&planes);
+    image_planes_free(&og_planes);
+
+    return result;
+}
+
+// Blind FFT: every bit is spread over STEG_FFT_BLIND_CHIPS keyed coefficients
+// of one channel's spectrum. The projection of their real parts on a keyed +-1
+// pattern is quantized to a lattice whose parity is the bit, so extraction only
+// needs the stego image and the key.
+#define STEG_FFT_BLIND_CHIPS 16
+#define STEG_FFT_BLIND_STRENGTH 0.04
+#define STEG_FFT_BLIND_BAND_LOW 0.0625
+#define STEG_FFT_BLIND_BAND_HIGH 0.25
+
+static uint64_t steg__rng_next(uint64_t *state) {
+    // splitmix64
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// Collects the coefficients of the mid-frequency band in the upper half plane
+// (their conjugate partners live in the lower half) and shuffles them with the
+// key, so that chip j of bit b is positions[b * STEG_FFT_BLIND_CHIPS + j].
+static size_t steg__fft_blind_positions(size_t width, size_t height, uint64_t key, size_t *positions) {
+    size_t count = 0;
+    for (size_t row = 1; row < height / 2; row++) {
+        for (size_t col = 0; col < width; col++) {
+            double fy = (double)row / height;
+            double fx = (double)(col < width - col ? col : width - col) / width;
+            double radius = sqrt(fx * fx + fy * fy);
+            if (radius >= STEG_FFT_BLIND_BAND_LOW && radius < STEG_FFT_BLIND_BAND_HIGH) {
+                positions[count++] = row * width + col;
+            }
+        }
+    }
+
+    uint64_t state = key;
+    for (size_t i = count; i > 1; i--) {
+        size_t j = steg__rng_next(&state) % i;
+        size_t tmp = positions[i - 1];
+        positions[i - 1] = positions[j];
+        positions[j] = tmp;
+    }
+
+    return count;
+}
+
+static double steg__fft_blind_project(const complex double *fft_c, const size_t *positions, uint64_t *chips) {
+    double sum = 0.0;
+    for (size_t j = 0; j < STEG_FFT_BLIND_CHIPS; j++) {
+        double chip = (steg__rng_next(chips) & 1) ? 1.0 : -1.0;
+        sum += chip * creal(fft_c[positions[j]]);
+    }
+    return sum / sqrt(STEG_FFT_BLIND_CHIPS);
+}
+
+static void steg__fft_blind_update(complex double *fft_c, size_t width, size_t height,
+                                   const size_t *positions, uint64_t *chips, double delta) {
+    double step = delta / sqrt(STEG_FFT_BLIND_CHIPS);
+    for (size_t j = 0; j < STEG_FFT_BLIND_CHIPS; j++) {
+        double chip = (steg__rng_next(chips) & 1) ? 1.0 : -1.0;
+        size_t row = positions[j] / width;
+        size_t col = positions[j] % width;
+        size_t mirror = ((height - row) % height) * width + (width - col) % width;
+
+        // Keep the spectrum conjugate symmetric so the image stays real
+        fft_c[positions[j]] += chip * step;
+        fft_c[mirror] += chip * step;
+    }
+}
+
+static size_t steg__fft_blind_capacity(size_t num_chan, size_t position_count) {
+    return num_chan * (position_count / STEG_FFT_BLIND_CHIPS);
+}
+
+STEGDEF Steg_Result steg_hide_fft_blind(uint8_t *bytes, size_t width, size_t height, size_t num_chan,
+                                        const uint8_t *payload, size_t payload_length, uint64_t key) {
+    complex double *fft_c = NULL;
+    complex double *tmp = NULL;
+    size_t *positions = NULL;
+    Image_Planes planes = {0};
+
+    Steg_Result result = STEG_OK;
+
+    if ((width & (width - 1)) != 0 || (height & (height - 1)) != 0) {
+        steg__g_failure_reason = "The input data is not a power of 2 shape.";
+        return_defer(STEG_ERR);
+    }
+
+    positions = AIDS_REALLOC(NULL, sizeof(size_t) * width * height);
+    fft_c = AIDS_REALLOC(NULL, sizeof(complex double) * width * height);
+    tmp = AIDS_REALLOC(NULL, sizeof(complex double) * width * height);
+    if (positions == NULL || fft_c == NULL || tmp == NULL) {
+        steg__g_failure_reason = aids_failure_reason();
+        return_defer(STEG_ERR);
+    }
+
+    size_t position_count = steg__fft_blind_positions(width, height, key, positions);
+    uint8_t header[STEG_LENGTH_SIZE];
+    steg_put_length(header, payload_length, 0);
+    size_t total_bits = (STEG_LENGTH_SIZE + payload_length) * BYTE_SIZE;
+    if (total_bits > steg__fft_blind_capacity(num_chan, position_count)) {
+        steg__g_failure_reason = "Payload is too large for the cover image";
+        return_defer(STEG_ERR);
+    }
+
+    if (image_planes_alloc(&planes, width, height, num_chan) != IMAGE_OK) {
+        steg__g_failure_reason = "Could not allocate the image planes";
+        return_defer(STEG_ERR);
+    }
+    image_planes_from_bytes(&planes, bytes);
+
+    double delta = STEG_FFT_BLIND_STRENGTH * sqrt((double)(width * height));
+    for (size_t c = 0; c < num_chan; c++) {
+        for (size_t i = 0; i < width * height; i++) {
+            tmp[i] = planes.planes[c][i] + 0.0*I;
+        }
+        fft2d(tmp, width, height, fft_c);
+
+        // Bit b lives in channel b % num_chan, so each channel is transformed once
+        for (size_t b = c; b < total_bits; b += num_chan) {
+            size_t byte_index = b / BYTE_SIZE;
+            uint8_t byte = byte_index < STEG_LENGTH_SIZE
+                ? header[byte_index]
+                : payload[byte_index - STEG_LENGTH_SIZE];
+            int bit = (byte >> (BYTE_SIZE - b % BYTE_SIZE - 1)) & 0b00000001;
+
+            const size_t *chip_positions = positions + (b / num_chan) * STEG_FFT_BLIND_CHIPS;
+            uint64_t chips = key ^ (b + 1);
+            double s = steg__fft_blind_project(fft_c, chip_positions, &chips);
+
+            // Move the projection to the nearest lattice point of the right parity
+            double half = delta / 2.0;
+            double target = delta * round((s - bit * half) / delta) + bit * half;
+
+            chips = key ^ (b + 1);
+            steg__fft_blind_update(fft_c, width, height, chip_positions, &chips, target - s);
+        }
+
+        ifft2d(fft_c, width, height, tmp);
+
+        // The changes are mostly below one level, so plain rounding would cancel
+        // them; dithered rounding keeps the quantization error independent of them
+        uint64_t dither = key ^ (c + 1);
+        for (size_t i = 0; i < width * height; i++) {
+            double u = (double)(steg__rng_next(&dither) >> 11) / (double)(1ull << 53) - 0.5;
+            bytes[i * num_chan + c] = (unsigned char)fmin(fmax(round(creal(tmp[i]) * 255.0 + u), 0), 255);
+        }
+    }
+
+defer:
+    if (positions != NULL) {
+        AIDS_FREE(positions);
+    }
+    if (fft_c != NULL) {
+        AIDS_FREE(fft_c);
+    }
+    if (tmp != NULL) {
+        AIDS_FREE(tmp);
+    }
+    image_planes_free(&planes);
 
     return result;
 }
 
-STEGDEF Steg_Result steg_show_fft(const uint8_t *og_bytes, const uint8_t *bytes,
-                                  size_t width, size_t height, size_t num_chan, uint8_t **message) {
+STEGDEF Steg_Result steg_show_fft_blind(const uint8_t *bytes, size_t width, size_t height, size_t num_chan,
+                                        uint64_t key, uint8_t **message, size_t *message_length) {
     complex double *fft_c = NULL;
-    complex double *fft_ogc = NULL;
     complex double *tmp = NULL;
-    double *y = NULL;
+    size_t *positions = NULL;
+    uint8_t *bits = NULL;
+    Image_Planes planes = {0};
 
     Steg_Result result = STEG_OK;
 
-    // Validate input dimensions
     if ((width & (width - 1)) != 0 || (height & (height - 1)) != 0) {
         steg__g_failure_reason = "The input data is not a power of 2 shape.";
         return_defer(STEG_ERR);
     }
 
-    *message = AIDS_REALLOC(NULL, (width * height * num_chan) * sizeof(unsigned char));
-    if (*message == NULL) {
+    positions = AIDS_REALLOC(NULL, sizeof(size_t) * width * height);
+    fft_c = AIDS_REALLOC(NULL, sizeof(complex double) * width * height);
+    tmp = AIDS_REALLOC(NULL, sizeof(complex double) * width * height);
+    if (positions == NULL || fft_c == NULL || tmp == NULL) {
         steg__g_failure_reason = aids_failure_reason();
         return_defer(STEG_ERR);
     }
-    memset(*message, 0, (width * height * num_chan) * sizeof(unsigned char));
 
-    for (size_t c = 0; c < num_chan; c++) {
-        // Normalize the modified image and the original image to [0, 1] range
-        fft_c = AIDS_REALLOC(NULL, sizeof(complex double) * width * height);
-        if (fft_c == NULL) {
-            steg__g_failure_reason = aids_failure_reason();
-            return_defer(STEG_ERR);
-        }
-        fft_ogc = AIDS_REALLOC(NULL, sizeof(complex double) * width * height);
-        if (fft_ogc == NULL) {
-            steg__g_failure_reason = aids_failure_reason();
-            return_defer(STEG_ERR);
-        }
-        for (size_t i = 0; i < width * height; i++) {
-            fft_c[i] = (double)bytes[i * num_chan + c] / 255.0 + 0.0*I;
-            fft_ogc[i] = (double)og_bytes[i * num_chan + c] / 255.0 + 0.0*I;
-        }
+    size_t position_count = steg__fft_blind_positions(width, height, key, positions);
+    size_t capacity = steg__fft_blind_capacity(num_chan, position_count);
+    if (capacity < STEG_LENGTH_SIZE * BYTE_SIZE) {
+        steg__g_failure_reason = "The image is too small to carry a blind FFT payload";
+        return_defer(STEG_ERR);
+    }
 
-        // Perform FFT on the modified image data
-        tmp = AIDS_REALLOC(NULL, sizeof(complex double) * width * height);
-        if (tmp == NULL) {
-            steg__g_failure_reason = aids_failure_reason();
-            return_defer(STEG_ERR);
-        }
-        fft2d(fft_c, width, height, tmp);
-        memcpy(fft_c, tmp, sizeof(complex double) * width * height);
-        AIDS_FREE(tmp); tmp = NULL;
+    bits = AIDS_REALLOC(NULL, capacity / BYTE_SIZE + 1);
+    if (bits == NULL) {
+        steg__g_failure_reason = aids_failure_reason();
+        return_defer(STEG_ERR);
+    }
+    memset(bits, 0, capacity / BYTE_SIZE + 1);
 
-        // Perform FFT on the original image data
-        tmp = AIDS_REALLOC(NULL, sizeof(complex double) * width * height);
-        if (tmp == NULL) {
-            steg__g_failure_reason = aids_failure_reason();
-            return_defer(STEG_ERR);
-        }
-        fft2d(fft_ogc, width, height, tmp);
-        memcpy(fft_ogc, tmp, sizeof(complex double) * width * height);
-        AIDS_FREE(tmp); tmp = NULL;
+    if (image_planes_alloc(&planes, width, height, num_chan) != IMAGE_OK) {
+        steg__g_failure_reason = "Could not allocate the image planes";
+        return_defer(STEG_ERR);
+    }
+    image_planes_from_bytes(&planes, bytes);
 
-        // Get the difference between the FFT coefficients of the modified image and the original image
+    double delta = STEG_FFT_BLIND_STRENGTH * sqrt((double)(width * height));
+    for (size_t c = 0; c < num_chan; c++) {
         for (size_t i = 0; i < width * height; i++) {
-            fft_c[i] = fft_c[i] - fft_ogc[i];
+            tmp[i] = planes.planes[c][i] + 0.0*I;
         }
+        fft2d(tmp, width, height, fft_c);
 
-        // Centralize the FFT coefficients to [0, 1] range and extract the payload
-        double low, high;
-        y = AIDS_REALLOC(NULL, sizeof(double) * width * height);
-        steg__centralize(fft_c, width, height, y, &low, &high);
-        for (size_t i = 0; i < width * height; i++) {
-            unsigned char payload_byte = (unsigned char)fmin(fmax(y[i] * 255.0, 0), 255);
-            (*message)[i * num_chan + c] = payload_byte;
+        for (size_t b = c; b < capacity; b += num_chan) {
+            const size_t *chip_positions = positions + (b / num_chan) * STEG_FFT_BLIND_CHIPS;
+            uint64_t chips = key ^ (b + 1);
+            double s = steg__fft_blind_project(fft_c, chip_positions, &chips);
+
+            uint8_t bit = (uint8_t)((long long)round(s / (delta / 2.0)) & 1);
+            bits[b / BYTE_SIZE] |= bit << (BYTE_SIZE - b % BYTE_SIZE - 1);
         }
-        AIDS_FREE(y); y = NULL;
+    }
 
-        AIDS_FREE(fft_c); fft_c = NULL;
-        AIDS_FREE(fft_ogc); fft_ogc = NULL;
-        AIDS_FREE(tmp); tmp = NULL;
-        AIDS_FREE(y); y = NULL;
+    *message_length = steg_get_length(bits, NULL);
+    if (*message_length > capacity / BYTE_SIZE - STEG_LENGTH_SIZE) {
+        steg__g_failure_reason = "Message length exceeds the maximum allowed size";
+        return_defer(STEG_ERR);
     }
 
+    *message = AIDS_REALLOC(NULL, (*message_length + 1) * sizeof(unsigned char));
+    if (*message == NULL) {
+        steg__g_failure_reason = aids_failure_reason();
+        return_defer(STEG_ERR);
+    }
+    memcpy(*message, bits + STEG_LENGTH_SIZE, *message_length);
+    (*message)[*message_length] = 0;
+
 defer:
+    if (positions != NULL) {
+        AIDS_FREE(positions);
+    }
     if (fft_c != NULL) {
         AIDS_FREE(fft_c);
     }
-    if (fft_ogc != NULL) {
-        AIDS_FREE(fft_ogc);
-    }
     if (tmp != NULL) {
         AIDS_FREE(tmp);
     }
-    if (y != NULL) {
-        AIDS_FREE(y);
+    if (bits != NULL) {
+        AIDS_FREE(bits);
     }
+    image_planes_free(&planes);
 
     return result;
 }
 
-const size_t COEFF_Xs[4] = {4};
-const size_t COEFF_Ys[4] = {3};
+// Coefficients carrying the bits of a block, `compression` selects the first
+// 1..STEG_DCT_MAX_COEFFS of them. All sit in the mid-frequency band around the
+// anti-diagonal (zig-zag indices 23..39 for 8x8 blocks): low enough to survive
+// smoothing and quantization, high enough to stay out of the visible low
+// frequencies. (4, 3) comes first so one bit per block keeps its original
+// position. The other block sizes use the same band at their own scale.
+#define STEG_DCT_MAX_COEFFS 8
 
 static bool steg__validate_compression_dct(size_t compression) {
-    // TODO: Find some edge cases where this is not true
-    AIDS_UNUSED(compression);
-    return true;
+    return compression > 0 && compression <= STEG_DCT_MAX_COEFFS;
+}
+
+// The extractor's parity rule is defined on the coefficients of [0, 1]
+// normalized samples: bit = round(c) mod 2. dct2d_int works on bytes and scales
+// its output by 8, so one normalized unit is STEG_DCT_UNIT integer units and the
+// rule becomes round(C / STEG_DCT_UNIT) mod 2, rounding halves away from zero
+// like round(). The level shift only changes the DC coefficient.
+//
+// Other block sizes scale the step with the block side: a basis image of an
+// n x n block has amplitude ~2 / n, so a step of STEG_DCT_UNIT * n / 8 moves
+// the samples by the same amount whatever the size.
+#define STEG_DCT_UNIT (8 * 255)
+
+static int steg__dct_parity_unit(int coeff, int step) {
+    if (coeff >= 0) {
+        return (coeff + step / 2) / step;
+    }
+    return -((-coeff + step / 2) / step);
+}
+
+// Returns the change to `coeff` that makes it carry `value`: the distance to the
+// closest multiple of `step` with the right parity, minus the original.
+// `push` overshoots that multiple in the direction of the move, still inside
+// its bin, for coefficients whose move was eaten by clipping last time.
+// The result is in idct2d_int units (not scaled by 8).
+static int16_t steg__dct_embed_delta(int coeff, int step, char value, int push) {
+    int unit = steg__dct_parity_unit(coeff, step);
+    if ((unit & 1) != value) {
+        unit += coeff >= unit * step ? 1 : -1;
+    }
+    int target = unit * step;
+    int delta = (coeff < target ? target + push : target - push) - coeff;
+    return (int16_t)(delta >= 0 ? (delta + 4) / 8 : -((-delta + 4) / 8));
+}
+
+typedef struct {
+    size_t block_size;
+    int unit;          // parity step, see STEG_DCT_UNIT
+    size_t max_coeffs; // usable entries of xs/ys, a 4x4 block clips with more
+    size_t xs[STEG_DCT_MAX_COEFFS];
+    size_t ys[STEG_DCT_MAX_COEFFS];
+} Steg_Dct_Layout;
+
+static const Steg_Dct_Layout STEG_DCT_LAYOUTS[] = {
+    {4, STEG_DCT_UNIT / 2, 4, {2, 1, 3, 0}, {1, 2, 0, 3}},
+    // zig-zag:                                    32 31 33 30 24 39 23 25
+    {BLOCK_SIZE, STEG_DCT_UNIT, STEG_DCT_MAX_COEFFS, {4, 3, 5, 2, 3, 4, 4, 2}, {3, 4, 2, 5, 3, 4, 2, 4}},
+    {DCT_MAX_BLOCK_SIZE, STEG_DCT_UNIT * 2, STEG_DCT_MAX_COEFFS, {8, 6, 10, 4, 6, 8, 8, 4}, {6, 8, 4, 10, 6, 8, 4, 8}},
+};
+
+static const Steg_Dct_Layout *steg__dct_layout(size_t block_size) {
+    for (size_t i = 0; i < sizeof(STEG_DCT_LAYOUTS) / sizeof(STEG_DCT_LAYOUTS[0]); i++) {
+        if (STEG_DCT_LAYOUTS[i].block_size == block_size) {
+            return &STEG_DCT_LAYOUTS[i];
+        }
+    }
+    return NULL;
+}
+
+// The blocks of the width * num_chan sample grid are numbered row-major. The
+// length prefix lives in blocks [0, header_blocks) and the payload in the
+// blocks after it, each block carrying `compression` consecutive bits of its
+// segment, so block k knows its bit offset without walking the blocks before.
+//
+// A job works through its blocks one block row (strip) at a time: the strip is
+// converted from `bytes` into the job's own `strip` buffer, embedded/extracted
+// and written back before the next one, so the working set is one block row.
+//
+// In luma mode the sample grid is the width x height luma plane of the
+// num_chan pixels instead, and only the luma is written back.
+typedef struct {
+    uint8_t *bytes;
+    int16_t *strip;
+    size_t stride;
+    const Steg_Dct_Layout *layout;
+    size_t blocks_w;
+    bool luma;
+    size_t num_chan;
+    size_t compression;
+
+    size_t header_blocks;
+    uint8_t *header;
+    uint8_t *payload;
+    size_t payload_bits;
+
+    size_t block_begin;
+    size_t block_end;
+    size_t errors; // bits that did not survive the verification rounds
+} Steg_Dct_Job;
+
+#define STEG_DCT_HEADER_BITS (STEG_LENGTH_SIZE * BYTE_SIZE)
+#define STEG_DCT_MAX_THREADS 64
+// Smallest share of blocks worth a thread, a multiple of BYTE_SIZE so that
+// every worker starts on a byte boundary of its segment
+#define STEG_DCT_MIN_BLOCKS_PER_THREAD 1024
+// Re-embedding rounds for the blocks whose bits were lost to 8-bit rounding and
+// clipping. Round r pushes the coefficients r / STEG_DCT_PUSH_FRACTION of a
+// parity step past their target, at most STEG_DCT_MAX_PUSH / STEG_DCT_PUSH_FRACTION
+// so they stay inside the bin.
+#define STEG_DCT_VERIFY_ROUNDS 4
+#define STEG_DCT_PUSH_FRACTION 8
+#define STEG_DCT_MAX_PUSH 3
+
+static size_t steg__dct_header_blocks(size_t compression) {
+    return (STEG_DCT_HEADER_BITS + compression - 1) / compression;
+}
+
+// End of the blocks carrying the header CRC of an integrity framed body,
+// which are extracted and checked before the rest. Rounded up to BYTE_SIZE
+// blocks so that the shares of the rest still start on a message byte.
+static size_t steg__dct_integrity_blocks(size_t message_length, size_t compression, size_t header_blocks, size_t payload_blocks) {
+    size_t bits = (message_length < STEG_CRC_SIZE ? message_length : STEG_CRC_SIZE) * BYTE_SIZE;
+    size_t blocks = (bits + compression - 1) / compression;
+    blocks = (blocks + BYTE_SIZE - 1) / BYTE_SIZE * BYTE_SIZE;
+    return header_blocks + (blocks < payload_blocks ? blocks : payload_blocks);
+}
+
+static uint8_t *steg__dct_block_bits(const Steg_Dct_Job *job, size_t k, size_t *bit, size_t *count) {
+    uint8_t *bits = job->header;
+    size_t total = STEG_DCT_HEADER_BITS;
+    if (k >= job->header_blocks) {
+        bits = job->payload;
+        total = job->payload_bits;
+        k -= job->header_blocks;
+    }
+
+    *bit = k * job->compression;
+    *count = 0;
+    if (*bit < total) {
+        *count = total - *bit < job->compression ? total - *bit : job->compression;
+    }
+    return bits;
+}
+
+// Block k inside the strip of its block row
+static int16_t *steg__dct_block(const Steg_Dct_Job *job, size_t k) {
+    return job->strip + k % job->blocks_w * job->layout->block_size;
+}
+
+// End of the run of the job's blocks that shares a strip with block k
+static size_t steg__dct_strip_end(const Steg_Dct_Job *job, size_t k) {
+    size_t end = (k / job->blocks_w + 1) * job->blocks_w;
+    return end < job->block_end ? end : job->block_end;
 }
 
-static void block_from_array(const double *array, size_t stride, size_t block_x, size_t block_y, double block[BLOCK_SIZE][BLOCK_SIZE]) {
-    for (size_t i = 0; i < BLOCK_SIZE; i++) {
-        for (size_t j = 0; j < BLOCK_SIZE; j++) {
-            block[i][j] = array[(block_y * BLOCK_SIZE + i) * stride + (block_x * BLOCK_SIZE + j)];
+// Converts the samples under blocks [begin, end) of one block row into the strip
+static void steg__dct_load_strip(const Steg_Dct_Job *job, size_t begin, size_t end) {
+    size_t n = job->layout->block_size;
+    size_t col = begin % job->blocks_w * n;
+    size_t row = begin / job->blocks_w * n;
+    size_t count = (end - begin) * n;
+    for (size_t i = 0; i < n; i++) {
+        int16_t *samples = job->strip + i * job->stride + col;
+        if (job->luma) {
+            image_to_luma(job->bytes + ((row + i) * job->stride + col) * job->num_chan, count, job->num_chan, samples);
+        } else {
+            image_to_samples(job->bytes + (row + i) * job->stride + col, count, samples);
         }
     }
 }
 
-static void block_to_array(const double block[BLOCK_SIZE][BLOCK_SIZE], size_t stride, size_t block_x, size_t block_y, double *array) {
-    for (size_t i = 0; i < BLOCK_SIZE; i++) {
-        for (size_t j = 0; j < BLOCK_SIZE; j++) {
-            array[(block_y * BLOCK_SIZE + i) * stride + (block_x * BLOCK_SIZE + j)] = block[i][j];
+static void steg__dct_store_strip(const Steg_Dct_Job *job, size_t begin, size_t end) {
+    size_t n = job->layout->block_size;
+    size_t col = begin % job->blocks_w * n;
+    size_t row = begin / job->blocks_w * n;
+    size_t count = (end - begin) * n;
+    for (size_t i = 0; i < n; i++) {
+        const int16_t *samples = job->strip + i * job->stride + col;
+        if (job->luma) {
+            image_set_luma(job->bytes + ((row + i) * job->stride + col) * job->num_chan, count, job->num_chan, samples);
+        } else {
+            image_from_samples(samples, count, job->bytes + (row + i) * job->stride + col);
         }
     }
 }
 
-static void steg__hide_dct_helper(double *normalized, size_t width, size_t height, size_t num_chan,
-                                  const uint8_t *payload, size_t payload_length, size_t compression) {
-    size_t byte_index = 0;
-    size_t bit_index = 0;
-    for (size_t i = 0; i < width / BLOCK_SIZE && byte_index < payload_length; i++) {
-        for (size_t j = 0; j < height / BLOCK_SIZE && byte_index < payload_length; j++) {
-            double block[BLOCK_SIZE][BLOCK_SIZE] = {0};
-            block_from_array(normalized, width * num_chan, i, j, block);
+// Replaces the n x n coefficients of block k with the deltas that embed its
+// bits, zero everywhere else. Retry rounds (round > 0) only move the
+// coefficients that do not carry their bit yet, pushing further every round.
+static void steg__hide_dct_coeffs(const Steg_Dct_Job *job, size_t k, int16_t *X, size_t round) {
+    const Steg_Dct_Layout *layout = job->layout;
+    size_t push_round = round < STEG_DCT_MAX_PUSH ? round : STEG_DCT_MAX_PUSH;
+    int push = (int)push_round * layout->unit / STEG_DCT_PUSH_FRACTION;
+    int16_t delta[STEG_DCT_MAX_COEFFS];
+
+    size_t bit, count;
+    const uint8_t *bits = steg__dct_block_bits(job, k, &bit, &count);
+    for (size_t c = 0; c < count; c++, bit++) {
+        char value = (bits[bit / BYTE_SIZE] >> (BYTE_SIZE - bit % BYTE_SIZE - 1)) & 0b00000001;
+        int coeff = X[layout->xs[c] * layout->block_size + layout->ys[c]];
+        if (round > 0 && (steg__dct_parity_unit(coeff, layout->unit) & 1) == value) {
+            delta[c] = 0;
+        } else {
+            delta[c] = steg__dct_embed_delta(coeff, layout->unit, value, push);
+        }
+    }
+
+    memset(X, 0, sizeof(int16_t) * layout->block_size * layout->block_size);
+    for (size_t c = 0; c < count; c++) {
+        X[layout->xs[c] * layout->block_size + layout->ys[c]] = delta[c];
+    }
+}
+
+// Adds the inverse transform of the deltas to the samples, so the rest of the
+// block is left exactly as it was
+static void steg__hide_dct_apply(int16_t *block, size_t stride, const int16_t *diff, size_t diff_stride, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = 0; j < n; j++) {
+            int sample = block[i * stride + j] + diff[i * diff_stride + j];
+            block[i * stride + j] = sample < -128 ? -128 : sample > 127 ? 127 : sample;
+        }
+    }
+}
+
+static void steg__hide_dct_block(const Steg_Dct_Job *job, size_t k, int16_t *X, size_t round) {
+    size_t n = job->layout->block_size;
+    int16_t *block = steg__dct_block(job, k);
+
+    int16_t diff[DCT_MAX_BLOCK_SIZE * DCT_MAX_BLOCK_SIZE];
+    steg__hide_dct_coeffs(job, k, X, round);
+    idct2d_int_n(n, X, diff, n);
+    steg__hide_dct_apply(block, job->stride, diff, n, n);
+}
+
+static void steg__hide_dct_batch(const Steg_Dct_Job *job, size_t k) {
+    int16_t *strip = steg__dct_block(job, k);
+
+    int16_t X[DCT_INT_BATCH][BLOCK_SIZE][BLOCK_SIZE];
+    dct2d_int_batch(strip, job->stride, X);
+    for (size_t b = 0; b < DCT_INT_BATCH; b++) {
+        steg__hide_dct_coeffs(job, k + b, &X[b][0][0], 0);
+    }
 
-            double dct_block[BLOCK_SIZE][BLOCK_SIZE] = {0};
-            dct2d(block, dct_block);
+    int16_t diff[BLOCK_SIZE][DCT_INT_BATCH * BLOCK_SIZE];
+    idct2d_int_batch(X, &diff[0][0], DCT_INT_BATCH * BLOCK_SIZE);
+    for (size_t b = 0; b < DCT_INT_BATCH; b++) {
+        steg__hide_dct_apply(strip + b * BLOCK_SIZE, job->stride, &diff[0][b * BLOCK_SIZE], DCT_INT_BATCH * BLOCK_SIZE,
+                             BLOCK_SIZE);
+    }
+}
 
-            for (size_t k = 0; k < compression; k++) {
-                uint8_t byte = payload[byte_index];
-                char bit = (byte >> (BYTE_SIZE - bit_index - 1)) & 0b00000001;
+// Only 8x8 blocks have a batched kernel
+static bool steg__dct_use_batch(const Steg_Dct_Job *job, size_t k, size_t end) {
+    return job->layout->block_size == BLOCK_SIZE && k + DCT_INT_BATCH <= end;
+}
 
-                double coeff = dct_block[COEFF_Xs[k]][COEFF_Ys[k]];
+// Number of bits of block k that the coefficients X do not carry
+static size_t steg__dct_block_errors(const Steg_Dct_Job *job, size_t k, const int16_t *X) {
+    const Steg_Dct_Layout *layout = job->layout;
+    size_t errors = 0;
+
+    size_t bit, count;
+    const uint8_t *bits = steg__dct_block_bits(job, k, &bit, &count);
+    for (size_t c = 0; c < count; c++, bit++) {
+        char value = (bits[bit / BYTE_SIZE] >> (BYTE_SIZE - bit % BYTE_SIZE - 1)) & 0b00000001;
+        int coeff = X[layout->xs[c] * layout->block_size + layout->ys[c]];
+        errors += (steg__dct_parity_unit(coeff, layout->unit) & 1) != value;
+    }
+    return errors;
+}
 
-                coeff = round(coeff) - ((int)coeff % 2) + bit;
-                dct_block[COEFF_Xs[k]][COEFF_Ys[k]] = coeff;
+// Reads the stored strip back (the samples are now rounded and clipped to 8
+// bits, or to the RGB gamut in luma mode) and re-embeds only the blocks whose
+// bits did not survive, for up to STEG_DCT_VERIFY_ROUNDS rounds. The bits still
+// wrong after that are added to job->errors.
+static void steg__hide_dct_verify(Steg_Dct_Job *job, size_t begin, size_t end) {
+    size_t n = job->layout->block_size;
+    for (size_t round = 1;; round++) {
+        steg__dct_load_strip(job, begin, end);
+
+        size_t failed = 0;
+        for (size_t k = begin; k < end;) {
+            int16_t X[DCT_INT_BATCH][DCT_MAX_BLOCK_SIZE * DCT_MAX_BLOCK_SIZE];
+            size_t blocks = 1;
+            if (steg__dct_use_batch(job, k, end)) {
+                int16_t batch[DCT_INT_BATCH][BLOCK_SIZE][BLOCK_SIZE];
+                dct2d_int_batch(steg__dct_block(job, k), job->stride, batch);
+                for (size_t b = 0; b < DCT_INT_BATCH; b++) {
+                    memcpy(X[b], batch[b], sizeof(batch[b]));
+                }
+                blocks = DCT_INT_BATCH;
+            } else {
+                dct2d_int_n(n, steg__dct_block(job, k), job->stride, X[0]);
+            }
 
-                bit_index++;
-                if (bit_index >= BYTE_SIZE) {
-                    bit_index = 0;
-                    byte_index++;
+            for (size_t b = 0; b < blocks; b++, k++) {
+                size_t errors = steg__dct_block_errors(job, k, X[b]);
+                if (errors == 0) {
+                    continue;
+                }
+                if (round > STEG_DCT_VERIFY_ROUNDS) {
+                    failed += errors;
+                } else {
+                    steg__hide_dct_block(job, k, X[b], round);
+                    failed += 1;
                 }
             }
+        }
+
+        if (round > STEG_DCT_VERIFY_ROUNDS) {
+            job->errors += failed;
+            return;
+        }
+        if (failed == 0) {
+            return;
+        }
+        steg__dct_store_strip(job, begin, end);
+    }
+}
 
-            idct2d(dct_block, block);
-            block_to_array(block, width * num_chan, i, j, normalized);
+static void *steg__hide_dct_worker(void *arg) {
+    Steg_Dct_Job *job = arg;
+    size_t n = job->layout->block_size;
+    for (size_t begin = job->block_begin; begin < job->block_end;) {
+        size_t end = steg__dct_strip_end(job, begin);
+        steg__dct_load_strip(job, begin, end);
+        for (size_t k = begin; k < end;) {
+            if (steg__dct_use_batch(job, k, end)) {
+                steg__hide_dct_batch(job, k);
+                k += DCT_INT_BATCH;
+            } else {
+                int16_t X[DCT_MAX_BLOCK_SIZE * DCT_MAX_BLOCK_SIZE];
+                dct2d_int_n(n, steg__dct_block(job, k), job->stride, X);
+                steg__hide_dct_block(job, k, X, 0);
+                k += 1;
+            }
         }
+        steg__dct_store_strip(job, begin, end);
+        steg__hide_dct_verify(job, begin, end);
+        begin = end;
     }
+    return NULL;
 }
 
-static void steg__show_dct_helper(const double *normalized, size_t width, size_t height, size_t num_chan,
-                                  uint8_t *message, size_t message_length, size_t compression) {
-    size_t bit_index = 0;
-    size_t byte_index = 0;
-    uint8_t byte = 0;
-    for (size_t i = 0; i < width / BLOCK_SIZE && byte_index < message_length; i++) {
-        for (size_t j = 0; j < height / BLOCK_SIZE && byte_index < message_length; j++) {
-            double block[BLOCK_SIZE][BLOCK_SIZE] = {0};
-            block_from_array(normalized, width * num_chan, i, j, block);
+static void steg__show_dct_coeffs(const Steg_Dct_Job *job, size_t k, const int16_t *X) {
+    const Steg_Dct_Layout *layout = job->layout;
 
-            double dct_block[BLOCK_SIZE][BLOCK_SIZE] = {0};
-            dct2d(block, dct_block);
+    size_t bit, count;
+    uint8_t *bits = steg__dct_block_bits(job, k, &bit, &count);
+    for (size_t c = 0; c < count; c++, bit++) {
+        int coeff = X[layout->xs[c] * layout->block_size + layout->ys[c]];
+        uint8_t value = (uint8_t)steg__dct_parity_unit(coeff, layout->unit) & 0b00000001;
+        bits[bit / BYTE_SIZE] |= value << (BYTE_SIZE - bit % BYTE_SIZE - 1);
+    }
+}
 
-            for (size_t k = 0; k < compression; k++) {
-                double coeff = dct_block[COEFF_Xs[k]][COEFF_Ys[k]];
-                uint8_t bit = (uint8_t)((int)round(coeff) % 2) & 0b00000001;
-                byte |= (bit << (BYTE_SIZE - bit_index - 1));
+static void steg__show_dct_block(const Steg_Dct_Job *job, size_t k) {
+    int16_t X[DCT_MAX_BLOCK_SIZE * DCT_MAX_BLOCK_SIZE];
+    dct2d_int_n(job->layout->block_size, steg__dct_block(job, k), job->stride, X);
+    steg__show_dct_coeffs(job, k, X);
+}
 
-                bit_index += compression;
-                if (bit_index >= BYTE_SIZE) {
-                    message[byte_index] = byte;
+static void steg__show_dct_batch(const Steg_Dct_Job *job, size_t k) {
+    const int16_t *strip = steg__dct_block(job, k);
 
-                    byte_index++;
-                    bit_index = 0;
-                    byte = 0;
-                }
+    int16_t X[DCT_INT_BATCH][BLOCK_SIZE][BLOCK_SIZE];
+    dct2d_int_batch(strip, job->stride, X);
+    for (size_t b = 0; b < DCT_INT_BATCH; b++) {
+        steg__show_dct_coeffs(job, k + b, &X[b][0][0]);
+    }
+}
+
+static void *steg__show_dct_worker(void *arg) {
+    const Steg_Dct_Job *job = arg;
+    for (size_t begin = job->block_begin; begin < job->block_end;) {
+        size_t end = steg__dct_strip_end(job, begin);
+        steg__dct_load_strip(job, begin, end);
+        for (size_t k = begin; k < end;) {
+            if (steg__dct_use_batch(job, k, end)) {
+                steg__show_dct_batch(job, k);
+                k += DCT_INT_BATCH;
+            } else {
+                steg__show_dct_block(job, k);
+                k += 1;
             }
         }
+        begin = end;
     }
+    return NULL;
 }
 
-STEGDEF Steg_Result steg_hide_dct(uint8_t *bytes, size_t width, size_t height, size_t num_chan,
-                                  const uint8_t *payload, size_t payload_length, size_t compression) {
-    double *normalized = NULL;
+// Splits [begin, end) over worker threads. The blocks are disjoint pixel regions
+// and, since every share starts on a byte boundary, disjoint message bytes, so
+// the result is the same as running the worker once over the whole range.
+// Every share gets its own strip buffer, their error counts add up in job.
+static Steg_Result steg__dct_parallel(Steg_Dct_Job *job, size_t begin, size_t end, void *(*worker)(void *)) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t num_threads = cpus > 0 ? (size_t)cpus : 1;
+    if (num_threads > STEG_DCT_MAX_THREADS) {
+        num_threads = STEG_DCT_MAX_THREADS;
+    }
+    size_t max_useful = (end - begin) / STEG_DCT_MIN_BLOCKS_PER_THREAD;
+    if (num_threads > max_useful) {
+        num_threads = max_useful > 0 ? max_useful : 1;
+    }
 
-    Steg_Result result = STEG_OK;
+    size_t share = (end - begin + num_threads - 1) / num_threads;
+    share = (share + BYTE_SIZE - 1) / BYTE_SIZE * BYTE_SIZE;
 
-    if (!steg__validate_compression_dct(compression)) {
+    size_t strip_size = job->layout->block_size * job->stride;
+    int16_t *strips = AIDS_REALLOC(NULL, sizeof(int16_t) * num_threads * strip_size);
+    if (strips == NULL) {
+        steg__g_failure_reason = aids_failure_reason();
+        return STEG_ERR;
+    }
+
+    Steg_Dct_Job jobs[STEG_DCT_MAX_THREADS];
+    pthread_t threads[STEG_DCT_MAX_THREADS];
+    bool started[STEG_DCT_MAX_THREADS] = {0};
+    for (size_t t = 0; t < num_threads; t++) {
+        jobs[t] = *job;
+        jobs[t].strip = strips + t * strip_size;
+        jobs[t].errors = 0;
+        jobs[t].block_begin = begin + t * share < end ? begin + t * share : end;
+        jobs[t].block_end = begin + (t + 1) * share < end ? begin + (t + 1) * share : end;
+    }
+
+    // The calling thread takes the first share
+    for (size_t t = 1; t < num_threads; t++) {
+        started[t] = pthread_create(&threads[t], NULL, worker, &jobs[t]) == 0;
+    }
+    worker(&jobs[0]);
+    for (size_t t = 1; t < num_threads; t++) {
+        if (started[t]) {
+            pthread_join(threads[t], NULL);
+        } else {
+            worker(&jobs[t]);
+        }
+    }
+    for (size_t t = 0; t < num_threads; t++) {
+        job->errors += jobs[t].errors;
+    }
+
+    AIDS_FREE(strips);
+    return STEG_OK;
+}
+
+// Luma mode needs RGB(A) pixels, the interleaved grid takes any channel count
+static const Steg_Dct_Layout *steg__validate_dct(size_t width, size_t height, size_t num_chan,
+                                                 const Steg_Dct_Options *options) {
+    size_t block_size = options->block_size > 0 ? options->block_size : BLOCK_SIZE;
+    const Steg_Dct_Layout *layout = steg__dct_layout(block_size);
+    if (!steg__validate_compression_dct(options->compression)) {
         steg__g_failure_reason = "Invalid compression value";
-        return_defer(STEG_ERR);
+        return NULL;
+    }
+    if (layout == NULL) {
+        steg__g_failure_reason = "Invalid DCT block size";
+        return NULL;
     }
-    if (width % BLOCK_SIZE != 0 || height % BLOCK_SIZE != 0) {
+    if (options->compression > layout->max_coeffs) {
+        steg__g_failure_reason = "Invalid compression value for the DCT block size";
+        return NULL;
+    }
+    if (width % block_size != 0 || height % block_size != 0) {
         steg__g_failure_reason = "The input data is not a multiple of the DCT block size.";
+        return NULL;
+    }
+    if (options->luma && num_chan < 3) {
+        steg__g_failure_reason = "Luma embedding needs an RGB image";
+        return NULL;
+    }
+    return layout;
+}
+
+STEGDEF Steg_Result steg_hide_dct_ex(uint8_t *bytes, size_t width, size_t height, size_t num_chan,
+                                     const uint8_t *payload, size_t payload_length, const Steg_Dct_Options *options,
+                                     size_t *errors) {
+    Steg_Result result = STEG_OK;
+
+    const Steg_Dct_Layout *layout = steg__validate_dct(width, height, num_chan, options);
+    if (layout == NULL) {
         return_defer(STEG_ERR);
     }
-    if (payload_length > width * height * num_chan / BLOCK_SIZE / BLOCK_SIZE) {
+
+    size_t compression = options->compression;
+    size_t stride = options->luma ? width : width * num_chan;
+    size_t blocks_w = stride / layout->block_size;
+    size_t blocks_h = height / layout->block_size;
+    size_t header_blocks = steg__dct_header_blocks(compression);
+    size_t payload_blocks = (payload_length * BYTE_SIZE + compression - 1) / compression;
+    if (header_blocks + payload_blocks > blocks_w * blocks_h) {
         steg__g_failure_reason = "Payload is too large for the cover image";
         return_defer(STEG_ERR);
     }
 
-    normalized = AIDS_REALLOC(NULL, sizeof(double) * width * height * num_chan);
-    if (normalized == NULL) {
-        steg__g_failure_reason = aids_failure_reason();
+    // The length prefix and the payload are disjoint blocks, embed them in one go
+    uint8_t header[STEG_LENGTH_SIZE];
+    steg_put_length(header, payload_length, options->flags);
+    Steg_Dct_Job job = {
+        .bytes = bytes,
+        .stride = stride,
+        .layout = layout,
+        .blocks_w = blocks_w,
+        .luma = options->luma,
+        .num_chan = num_chan,
+        .compression = compression,
+        .header_blocks = header_blocks,
+        .header = header,
+        .payload = (uint8_t *)payload,
+        .payload_bits = payload_length * BYTE_SIZE,
+    };
+    if (steg__dct_parallel(&job, 0, header_blocks + payload_blocks, steg__hide_dct_worker) != STEG_OK) {
         return_defer(STEG_ERR);
     }
-    for (size_t i = 0; i < width * height * num_chan; i++) {
-        normalized[i] = (double)bytes[i] / 255.0;
+    if (errors != NULL) {
+        *errors = job.errors;
     }
 
-    steg__hide_dct_helper(normalized, width, height, num_chan, (uint8_t*)&payload_length, sizeof(size_t), compression);
-    size_t offset = sizeof(size_t) * num_chan * BLOCK_SIZE * BLOCK_SIZE;
-    steg__hide_dct_helper(normalized + offset, width, height, num_chan, payload, payload_length, compression);
+defer:
+    return result;
+}
+
+STEGDEF Steg_Result steg_show_dct_ex(const uint8_t *bytes, size_t width, size_t height, size_t num_chan,
+                                     uint8_t **message, size_t *message_length, const Steg_Dct_Options *options,
+                                     uint8_t *flags) {
+    Steg_Result result = STEG_OK;
 
-    for (size_t i = 0; i < width * height * num_chan; i++) {
-        bytes[i] = (unsigned char)fmin(fmax(normalized[i] * 255.0, 0), 255);
+    const Steg_Dct_Layout *layout = steg__validate_dct(width, height, num_chan, options);
+    if (layout == NULL) {
+        return_defer(STEG_ERR);
     }
 
-defer:
-    if (normalized != NULL) {
-        AIDS_FREE(normalized);
+    size_t compression = options->compression;
+    size_t stride = options->luma ? width : width * num_chan;
+    size_t blocks_w = stride / layout->block_size;
+    size_t blocks_h = height / layout->block_size;
+    size_t header_blocks = steg__dct_header_blocks(compression);
+    if (header_blocks > blocks_w * blocks_h) {
+        steg__g_failure_reason = "The image is too small to carry a DCT payload";
+        return_defer(STEG_ERR);
+    }
+
+    uint8_t header[STEG_LENGTH_SIZE] = {0};
+    Steg_Dct_Job job = {
+        .bytes = (uint8_t *)bytes, // the show workers never store their strips
+        .stride = stride,
+        .layout = layout,
+        .blocks_w = blocks_w,
+        .luma = options->luma,
+        .num_chan = num_chan,
+        .compression = compression,
+        .header_blocks = header_blocks,
+        .header = header,
+    };
+    if (steg__dct_parallel(&job, 0, header_blocks, steg__show_dct_worker) != STEG_OK) {
+        return_defer(STEG_ERR);
+    }
+    *message_length = steg_get_length(header, flags);
+    if (*message_length <= 0) {
+        steg__g_failure_reason = "Message length is invalid";
+        return_defer(STEG_ERR);
+    }
+    if (*message_length > (blocks_w * blocks_h - header_blocks) * compression / BYTE_SIZE) {
+        steg__g_failure_reason = "Message length exceeds the maximum allowed size";
+        return_defer(STEG_ERR);
+    }
+    *message = AIDS_REALLOC(NULL, (*message_length + 1) * sizeof(unsigned char));
+    if (*message == NULL) {
+        steg__g_failure_reason = aids_failure_reason();
+        return_defer(STEG_ERR);
+    }
+    memset(*message, 0, (*message_length + 1) * sizeof(unsigned char));
+
+    job.payload = *message;
+    job.payload_bits = *message_length * BYTE_SIZE;
+    size_t payload_blocks = (job.payload_bits + compression - 1) / compression;
+    size_t begin = header_blocks;
+    if (options->integrity) {
+        begin = steg__dct_integrity_blocks(*message_length, compression, header_blocks, payload_blocks);
+        if (steg__dct_parallel(&job, header_blocks, begin, steg__show_dct_worker) != STEG_OK) {
+            return_defer(STEG_ERR);
+        }
+        if (!steg_integrity_header_ok(*message_length, *message)) {
+            steg__g_failure_reason = "Integrity check failed: no payload in the cover";
+            return_defer(STEG_ERR);
+        }
+    }
+    if (steg__dct_parallel(&job, begin, header_blocks + payload_blocks, steg__show_dct_worker) != STEG_OK) {
+        return_defer(STEG_ERR);
     }
 
+defer:
     return result;
 }
 
+STEGDEF Steg_Result steg_hide_dct(uint8_t *bytes, size_t width, size_t height, size_t num_chan,
+                                  const uint8_t *payload, size_t payload_length, size_t compression) {
+    Steg_Dct_Options options = {.compression = compression};
+    return steg_hide_dct_ex(bytes, width, height, num_chan, payload, payload_length, &options, NULL);
+}
+
 STEGDEF Steg_Result steg_show_dct(const uint8_t *bytes, size_t width, size_t height, size_t num_chan,
                                   uint8_t **message, size_t *message_length, size_t compression) {
-    double *normalized = NULL;
+    Steg_Dct_Options options = {.compression = compression};
+    return steg_show_dct_ex(bytes, width, height, num_chan, message, message_length, &options, NULL);
+}
+
+// JPEG files are embedded in their quantized coefficients, so nothing is lost
+// to a decode/re-encode round trip. The blocks of all components are numbered
+// one component after the other, row-major inside each, and carry the same
+// header/payload layout as the pixel domain path at the same COEFF positions.
+// A bit is the parity of the quantized value.
+static size_t steg__jpeg_blocks(const Jpeg_Coefficients *jpeg) {
+    size_t blocks = 0;
+    for (size_t c = 0; c < jpeg->num_comp; c++) {
+        blocks += jpeg->comps[c].blocks_w * jpeg->comps[c].blocks_h;
+    }
+    return blocks;
+}
+
+static int16_t *steg__jpeg_block(const Jpeg_Coefficients *jpeg, size_t k) {
+    size_t c = 0;
+    while (k >= jpeg->comps[c].blocks_w * jpeg->comps[c].blocks_h) {
+        k -= jpeg->comps[c].blocks_w * jpeg->comps[c].blocks_h;
+        c++;
+    }
+    return jpeg_block(jpeg, c, k % jpeg->comps[c].blocks_w, k / jpeg->comps[c].blocks_w);
+}
+
+// Fixes the parity by moving towards zero, so no coefficient grows in magnitude
+// (and the file does not either), except zeros which have to become 1
+static void steg__hide_jpeg_block(const Steg_Dct_Job *job, int16_t *block, size_t k) {
+    size_t bit, count;
+    const uint8_t *bits = steg__dct_block_bits(job, k, &bit, &count);
+    for (size_t c = 0; c < count; c++, bit++) {
+        char value = (bits[bit / BYTE_SIZE] >> (BYTE_SIZE - bit % BYTE_SIZE - 1)) & 0b00000001;
+        int16_t *coeff = &block[job->layout->xs[c] * BLOCK_SIZE + job->layout->ys[c]];
+        if ((*coeff & 1) != value) {
+            *coeff = *coeff == 0 ? 1 : *coeff > 0 ? *coeff - 1 : *coeff + 1;
+        }
+    }
+}
+
+static void steg__show_jpeg_block(const Steg_Dct_Job *job, const int16_t *block, size_t k) {
+    size_t bit, count;
+    uint8_t *bits = steg__dct_block_bits(job, k, &bit, &count);
+    for (size_t c = 0; c < count; c++, bit++) {
+        uint8_t value = block[job->layout->xs[c] * BLOCK_SIZE + job->layout->ys[c]] & 0b00000001;
+        bits[bit / BYTE_SIZE] |= value << (BYTE_SIZE - bit % BYTE_SIZE - 1);
+    }
+}
 
+STEGDEF Steg_Result steg_hide_jpeg(const uint8_t *jpeg_data, size_t jpeg_size, const uint8_t *payload,
+                                   size_t payload_length, size_t compression, uint8_t flags,
+                                   uint8_t **output, size_t *output_size) {
     Steg_Result result = STEG_OK;
+    Jpeg_Coefficients jpeg = {0};
 
-    if (!steg__validate_compression(compression)) {
+    if (!steg__validate_compression_dct(compression)) {
         steg__g_failure_reason = "Invalid compression value";
         return_defer(STEG_ERR);
     }
-    if (width % BLOCK_SIZE != 0 || height % BLOCK_SIZE != 0) {
-        steg__g_failure_reason = "The input data is not a multiple of the DCT block size.";
+    if (jpeg_read_coefficients(jpeg_data, jpeg_size, &jpeg) != JPEG_OK) {
+        steg__g_failure_reason = jpeg_failure_reason();
         return_defer(STEG_ERR);
     }
 
-    normalized = AIDS_REALLOC(NULL, sizeof(double) * width * height * num_chan);
-    if (normalized == NULL) {
-        steg__g_failure_reason = aids_failure_reason();
+    size_t header_blocks = steg__dct_header_blocks(compression);
+    size_t payload_blocks = (payload_length * BYTE_SIZE + compression - 1) / compression;
+    if (header_blocks + payload_blocks > steg__jpeg_blocks(&jpeg)) {
+        steg__g_failure_reason = "Payload is too large for the cover image";
+        return_defer(STEG_ERR);
+    }
+
+    uint8_t header[STEG_LENGTH_SIZE];
+    steg_put_length(header, payload_length, flags);
+    Steg_Dct_Job job = {
+        .layout = steg__dct_layout(BLOCK_SIZE),
+        .compression = compression,
+        .header_blocks = header_blocks,
+        .header = header,
+        .payload = (uint8_t *)payload,
+        .payload_bits = payload_length * BYTE_SIZE,
+    };
+    for (size_t k = 0; k < header_blocks + payload_blocks; k++) {
+        steg__hide_jpeg_block(&job, steg__jpeg_block(&jpeg, k), k);
+    }
+
+    if (jpeg_write_coefficients(&jpeg, output, output_size) != JPEG_OK) {
+        steg__g_failure_reason = jpeg_failure_reason();
+        return_defer(STEG_ERR);
+    }
+
+defer:
+    jpeg_coefficients_free(&jpeg);
+    return result;
+}
+
+STEGDEF Steg_Result steg_show_jpeg(const uint8_t *jpeg_data, size_t jpeg_size, uint8_t **message,
+                                   size_t *message_length, size_t compression, int integrity, uint8_t *flags) {
+    Steg_Result result = STEG_OK;
+    Jpeg_Coefficients jpeg = {0};
+
+    if (!steg__validate_compression_dct(compression)) {
+        steg__g_failure_reason = "Invalid compression value";
+        return_defer(STEG_ERR);
+    }
+    if (jpeg_read_coefficients(jpeg_data, jpeg_size, &jpeg) != JPEG_OK) {
+        steg__g_failure_reason = jpeg_failure_reason();
         return_defer(STEG_ERR);
     }
-    for (size_t i = 0; i < width * height * num_chan; i++) {
-        normalized[i] = (double)bytes[i] / 255.0;
+
+    size_t blocks = steg__jpeg_blocks(&jpeg);
+    size_t header_blocks = steg__dct_header_blocks(compression);
+    if (header_blocks > blocks) {
+        steg__g_failure_reason = "The image is too small to carry a DCT payload";
+        return_defer(STEG_ERR);
     }
 
-    steg__show_dct_helper(normalized, width, height, num_chan, (uint8_t*)message_length, sizeof(size_t), compression);
-    printf("Message length: %zu\n", *message_length);
+    uint8_t header[STEG_LENGTH_SIZE] = {0};
+    Steg_Dct_Job job = {
+        .layout = steg__dct_layout(BLOCK_SIZE),
+        .compression = compression,
+        .header_blocks = header_blocks,
+        .header = header,
+    };
+    for (size_t k = 0; k < header_blocks; k++) {
+        steg__show_jpeg_block(&job, steg__jpeg_block(&jpeg, k), k);
+    }
+    *message_length = steg_get_length(header, flags);
     if (*message_length <= 0) {
         steg__g_failure_reason = "Message length is invalid";
         return_defer(STEG_ERR);
     }
-    if (*message_length > width * height * num_chan / BLOCK_SIZE / BLOCK_SIZE) {
+    if (*message_length > (blocks - header_blocks) * compression / BYTE_SIZE) {
         steg__g_failure_reason = "Message length exceeds the maximum allowed size";
         return_defer(STEG_ERR);
     }
@@ -546,14 +2515,27 @@ STEGDEF Steg_Result steg_show_dct(const uint8_t *bytes, size_t width, size_t hei
         return_defer(STEG_ERR);
     }
     memset(*message, 0, (*message_length + 1) * sizeof(unsigned char));
-    size_t offset = sizeof(size_t) * num_chan * BLOCK_SIZE * BLOCK_SIZE;
-    steg__show_dct_helper(normalized + offset, width, height, num_chan, *message, *message_length, compression);
 
-defer:
-    if (normalized != NULL) {
-        AIDS_FREE(normalized);
+    job.payload = *message;
+    job.payload_bits = *message_length * BYTE_SIZE;
+    size_t payload_blocks = (job.payload_bits + compression - 1) / compression;
+    size_t begin = header_blocks;
+    if (integrity) {
+        begin = steg__dct_integrity_blocks(*message_length, compression, header_blocks, payload_blocks);
+        for (size_t k = header_blocks; k < begin; k++) {
+            steg__show_jpeg_block(&job, steg__jpeg_block(&jpeg, k), k);
+        }
+        if (!steg_integrity_header_ok(*message_length, *message)) {
+            steg__g_failure_reason = "Integrity check failed: no payload in the cover";
+            return_defer(STEG_ERR);
+        }
+    }
+    for (size_t k = begin; k < header_blocks + payload_blocks; k++) {
+        steg__show_jpeg_block(&job, steg__jpeg_block(&jpeg, k), k);
     }
 
+defer:
+    jpeg_coefficients_free(&jpeg);
     return result;
 }
 
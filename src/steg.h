@@ -4,6 +4,8 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "error.h"
+
 typedef enum {
     STEG_OK = 0,
     STEG_ERR = 1,
@@ -24,16 +26,174 @@ STEGDEF Steg_Result steg_show_lsb(const uint8_t *bytes, size_t bytes_length,
                                   uint8_t *message, size_t message_length,
                                   int compression);
 
+// Every method but the container (below) starts its stream with the payload
+// length in STEG_LENGTH_SIZE bytes, little endian whatever the width and byte
+// order of size_t in the build that wrote it. The last byte holds these flags,
+// which leaves 56 bits for the length.
+#define STEG_LENGTH_SIZE 8
+#define STEG_PAYLOAD_COMPRESSED 0x01 // The payload was deflated before hiding
+
+// Writes the length prefix, and reads one back into the length and the flags
+// (optional)
+STEGDEF void steg_put_length(uint8_t *out, size_t length, uint8_t flags);
+STEGDEF size_t steg_get_length(const uint8_t *in, uint8_t *flags);
+
+// LSB with error correction in one call, on top of the session below: the
+// message is allocated and NUL terminated. With integrity, the header CRC of
+// an integrity framed body (see below) is checked as soon as it is extracted.
+// `flags` (optional) receives the recorded STEG_PAYLOAD_* flags and
+// `uncorrected` (optional) the number of ECC units of the message that could
+// not be corrected; the message is returned all the same. A NULL ecc hides
+// and shows without error correction.
+STEGDEF Steg_Result steg_hide_lsb_ecc(uint8_t *bytes, size_t bytes_length,
+                                      const uint8_t *payload, size_t payload_length,
+                                      int compression, const Ecc_Options *ecc, uint8_t flags);
+STEGDEF Steg_Result steg_show_lsb_ecc(const uint8_t *bytes, size_t bytes_length,
+                                      uint8_t **message, size_t *message_length,
+                                      int compression, const Ecc_Options *ecc, int integrity,
+                                      uint8_t *flags, size_t *uncorrected);
+
+// Streaming LSB, in the format of steg_hide_lsb with a length prefix (or of
+// steg_hide_lsb_ecc with ecc). The writer takes the payload in any number of
+// pieces and fills in the length prefix at the end, the reader yields the
+// message as it is extracted, both in constant memory: ECC frames are encoded
+// and decoded a chunk at a time. steg_lsb_end and steg_lsb_close free the
+// session.
+typedef struct {
+    int compression;
+    const Ecc_Options *ecc; // NULL: no error correction
+    uint8_t flags;          // STEG_PAYLOAD_* flags recorded by the writer
+} Steg_Lsb_Params;
+
+typedef struct Steg_Lsb_Session Steg_Lsb_Session;
+
+STEGDEF Steg_Result steg_lsb_begin(uint8_t *bytes, size_t bytes_length, const Steg_Lsb_Params *params,
+                                   Steg_Lsb_Session **session);
+STEGDEF Steg_Result steg_lsb_write(Steg_Lsb_Session *session, const uint8_t *data, size_t length);
+STEGDEF Steg_Result steg_lsb_end(Steg_Lsb_Session *session);
+
+// message_length receives the length from the prefix and flags (optional) the
+// recorded STEG_PAYLOAD_* flags
+STEGDEF Steg_Result steg_lsb_open(const uint8_t *bytes, size_t bytes_length, const Steg_Lsb_Params *params,
+                                  Steg_Lsb_Session **session, size_t *message_length, uint8_t *flags);
+// Extracts up to capacity more bytes of the message, length is 0 at the end
+STEGDEF Steg_Result steg_lsb_read(Steg_Lsb_Session *session, uint8_t *data, size_t capacity, size_t *length);
+// ECC units read so far that could not be corrected, their bytes are returned
+// as extracted
+STEGDEF size_t steg_lsb_uncorrected(const Steg_Lsb_Session *session);
+STEGDEF void steg_lsb_close(Steg_Lsb_Session *session);
+
+// Chunked LSB container, every integer little endian:
+//
+//   magic "STGC" | version | flags | varint payload length | varint chunk size
+//   [ECC flag: varint code | varint parity | varint depth] | CRC32C of the above
+//   [CRC flag: CRC32C of every chunk] | chunks
+//
+// The payload is cut in chunk size pieces (the last one shorter) and every
+// piece is ECC coded on its own, so each chunk sits at a known offset and can
+// be extracted and checked without decoding the others.
+#define STEG_CONTAINER_MAGIC "STGC"
+#define STEG_CONTAINER_VERSION 1
+#define STEG_CONTAINER_ECC 0x01        // Chunks are ECC coded with the recorded options
+#define STEG_CONTAINER_COMPRESSED 0x02 // The payload was deflated before chunking
+#define STEG_CONTAINER_CRC 0x04        // The chunk table holds a CRC32C per chunk
+#define STEG_CONTAINER_CHUNK_SIZE (64 * 1024)
+
+typedef struct {
+    uint8_t version;
+    uint8_t flags;
+    size_t payload_length;
+    size_t chunk_size;
+    Ecc_Options ecc;
+
+    // Derived from the fields above
+    size_t chunk_count;
+    size_t frame_data;    // ECC frame data and code bytes (1 and 1 without ECC)
+    size_t frame_code;
+    size_t header_length; // Magic up to and including the header CRC
+    size_t data_offset;   // First chunk, after the chunk table
+    size_t chunk_code;    // Embedded bytes of a full chunk
+} Steg_Container;
+
+// ecc is only used with STEG_CONTAINER_ECC in flags
+STEGDEF Steg_Result steg_hide_lsb_container(uint8_t *bytes, size_t bytes_length,
+                                            const uint8_t *payload, size_t payload_length,
+                                            int compression, size_t chunk_size, uint8_t flags,
+                                            const Ecc_Options *ecc);
+// Whether the embedded stream starts with the container magic
+STEGDEF int steg_lsb_has_container(const uint8_t *bytes, size_t bytes_length, int compression);
+// Reads and checks the container header
+STEGDEF Steg_Result steg_show_lsb_container(const uint8_t *bytes, size_t bytes_length,
+                                            int compression, Steg_Container *container);
+// Extracts a single chunk into chunk, which holds at least chunk_size bytes.
+// `uncorrected` (optional) receives the number of ECC units of the chunk that
+// could not be corrected.
+STEGDEF Steg_Result steg_show_lsb_chunk(const uint8_t *bytes, size_t bytes_length, int compression,
+                                        const Steg_Container *container, size_t index,
+                                        uint8_t *chunk, size_t *chunk_length, size_t *uncorrected);
+// Extracts every chunk, spread over worker threads. The message is allocated
+// and NUL terminated, `uncorrected` (optional) receives the number of ECC
+// units of all the chunks that could not be corrected.
+STEGDEF Steg_Result steg_show_lsb_chunks(const uint8_t *bytes, size_t bytes_length, int compression,
+                                         const Steg_Container *container, uint8_t **message, size_t *uncorrected);
+
 STEGDEF Steg_Result steg_hide_fft(uint8_t *bytes, size_t width, size_t height, size_t num_chan,
                                   const uint8_t *payload, size_t payload_width, size_t payload_height, size_t payload_chan);
 STEGDEF Steg_Result steg_show_fft(const uint8_t *og_bytes, const uint8_t *bytes,
                                   size_t width, size_t height, size_t num_chan, uint8_t **message);
 
+STEGDEF Steg_Result steg_hide_fft_blind(uint8_t *bytes, size_t width, size_t height, size_t num_chan,
+                                        const uint8_t *payload, size_t payload_length, uint64_t key);
+STEGDEF Steg_Result steg_show_fft_blind(const uint8_t *bytes, size_t width, size_t height, size_t num_chan,
+                                        uint64_t key, uint8_t **message, size_t *message_length);
+
 STEGDEF Steg_Result steg_hide_dct(uint8_t *bytes, size_t width, size_t height, size_t num_chan,
                                   const uint8_t *payload, size_t payload_length, size_t compression);
 STEGDEF Steg_Result steg_show_dct(const uint8_t *bytes, size_t width, size_t height, size_t num_chan,
                                   uint8_t **message, size_t *message_length, size_t compression);
 
+// Knobs of the pixel domain DCT method (luma plane, block size, ...), all of
+// them taken by steg_hide_dct_ex/steg_show_dct_ex rather than by a variant per
+// knob. steg_hide_dct/steg_show_dct use the defaults (zero) for everything but
+// the compression.
+typedef struct {
+    size_t compression; // Coefficients per block, 1-8
+    size_t block_size;  // 4, 8 or 16 (0: 8)
+    int luma;           // Use the luma plane of RGB(A) images, the way JPEG sees them
+    int integrity;      // Extraction: check the header CRC of an integrity framed body early
+    uint8_t flags;      // Hiding: STEG_PAYLOAD_* flags to record
+} Steg_Dct_Options;
+
+// Every block is verified after the image is written back to 8 bits, and the
+// blocks that lost bits are re-embedded a few times. `errors` (optional)
+// receives the number of bits still wrong after that, `flags` (optional) the
+// recorded STEG_PAYLOAD_* flags on extraction.
+STEGDEF Steg_Result steg_hide_dct_ex(uint8_t *bytes, size_t width, size_t height, size_t num_chan,
+                                     const uint8_t *payload, size_t payload_length, const Steg_Dct_Options *options,
+                                     size_t *errors);
+STEGDEF Steg_Result steg_show_dct_ex(const uint8_t *bytes, size_t width, size_t height, size_t num_chan,
+                                     uint8_t **message, size_t *message_length, const Steg_Dct_Options *options,
+                                     uint8_t *flags);
+
+STEGDEF Steg_Result steg_hide_jpeg(const uint8_t *jpeg_data, size_t jpeg_size, const uint8_t *payload,
+                                   size_t payload_length, size_t compression, uint8_t flags,
+                                   uint8_t **output, size_t *output_size);
+STEGDEF Steg_Result steg_show_jpeg(const uint8_t *jpeg_data, size_t jpeg_size, uint8_t **message,
+                                   size_t *message_length, size_t compression, int integrity, uint8_t *flags);
+
+// Optional integrity framing, applied to the payload before any method hides
+// it: CRC32C of the method's length header, the payload, then CRC32C of the
+// header and everything before it. The extractors given the integrity flag
+// check the header CRC (steg_integrity_header_ok) as soon as it is out and
+// stop there for covers without a payload; steg_integrity_unwrap checks the
+// trailer and strips both in place.
+#define STEG_CRC_SIZE 4
+
+STEGDEF Steg_Result steg_integrity_wrap(const uint8_t *payload, size_t payload_length,
+                                        uint8_t **body, size_t *body_length);
+STEGDEF int steg_integrity_header_ok(size_t body_length, const uint8_t *body);
+STEGDEF Steg_Result steg_integrity_unwrap(uint8_t *body, size_t *body_length);
+
 STEGDEF const char *steg_failure_reason(void);
 
 #endif // STEG_H